@@ -0,0 +1,44 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * hook.c - example pre-exec hook; see src/hook.h.
+ *
+ * This does what pre.sh does without any process creation for the
+ * common case: nothing to plumb. A netns that needs its veth pair
+ * set up is left to pre.sh.
+ *
+ * Build:
+ *
+ *      cc -O2 -shared -fPIC -I../src -o hook.so hook.c
+ *
+ * and run ns --hook=/path/to/hook.so pre.sh ...
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+#define _GNU_SOURCE
+#include <sched.h>
+#include <errno.h>
+
+#include "hook.h"
+
+int
+ns_pre_exec(pid_t pid, int flags, const struct ns_hook_config *cfg)
+{
+    (void)pid;
+
+    if (cfg->version != NS_HOOK_VERSION) return -EPROTO;
+
+    if (!(flags & CLONE_NEWNET) || cfg->veth) return 0;
+
+    return NS_HOOK_SCRIPT;
+}
+
+/* EOF */
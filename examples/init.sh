@@ -9,6 +9,7 @@
 #   CLONE_NEWUSER   -- set if 'ns' is invoked with '-u'
 #   CLONE_NEWNET    -- set if 'ns' is invoked with '-n'
 #   DEBUG           -- set if the 'ns' utility is built in debug mode
+#   NS_VETH         -- set if 'ns' already configured eth0 (--veth)
 #
 # By the time this script is invoked, 'ns' has already done the
 # following:
@@ -30,9 +31,11 @@ fi
 
 # The IP address here mirrors the setup in pre.sh.
 # For production use, rely on DHCP instead of hard-coding these.
-ip addr add 10.99.88.2/24 dev eth0  || exit 5
-ip link set up dev eth0             || exit 6
-ip route add default via 10.99.88.1 || exit 7
+if [ -z "$NS_VETH" ]; then
+    ip addr add 10.99.88.2/24 dev eth0  || exit 5
+    ip link set up dev eth0             || exit 6
+    ip route add default via 10.99.88.1 || exit 7
+fi
 
 # Environment var set by the caller
 if [ -n "$DEBUG" ]; then
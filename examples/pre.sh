@@ -7,6 +7,9 @@
 #
 #   CLONE_NEWUSER
 #   CLONE_NEWNET
+#   NS_VETH         -- set if 'ns' already plumbed a veth pair (--veth)
+#   NS_POOL_VETH    -- set to the host end of the veth pair that came
+#                      with a pooled netns (--netns-pool)
 #
 #
 # Must exit with 0 on success; else container setup will fail.
@@ -14,13 +17,17 @@
 
 Child=$1
 
-if [ -z "$CLONE_NEWNET" ]; then
+if [ -z "$CLONE_NEWNET" -o -n "$NS_VETH" ]; then
     exit 0
 fi
 
 # Network name of 'eth0' should be the same one used in the child
 # namespace. 'veth0' is the interface name in the host (parent namespace).
-ip link add name veth0 type veth peer eth0 netns $Child || exit 1
+if [ -n "$NS_POOL_VETH" ]; then
+    ip link set dev $NS_POOL_VETH name veth0            || exit 1
+else
+    ip link add name veth0 type veth peer eth0 netns $Child || exit 1
+fi
 ip addr add 10.99.88.1/24 dev veth0                     || exit 2
 ip link set up dev veth0                                || exit 3
 
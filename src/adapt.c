@@ -0,0 +1,156 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * adapt.c - memory.high driven by memory pressure (cgroup v2).
+ *
+ * A hard limit either OOM kills a container that bursts past it or
+ * holds RAM an idle one doesn't need. Here, the ceiling is soft
+ * (memory.high) and moves: up when the container stalls on memory
+ * (a PSI trigger, see Documentation/accounting/psi.rst), and down
+ * while it doesn't. v1 has no per-cgroup pressure.
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "trace.h"
+#include "stats.h"
+#include "adapt.h"
+
+
+static uint64_t
+now_ms(void)
+{
+    return trace_now() / 1000000;
+}
+
+
+static uint64_t
+current(adapt *a)
+{
+    char buf[32];
+    ssize_t n = pread(a->cur, buf, sizeof buf - 1, 0);
+
+    if (n <= 0) return 0;
+    buf[n] = 0;
+    return strtoull(buf, 0, 10);
+}
+
+
+static int
+write_high(adapt *a, uint64_t v)
+{
+    char buf[32];
+    int  n = snprintf(buf, sizeof buf, "%llu", (unsigned long long)v);
+
+    return write(a->high, buf, n) < 0 ? -errno : 0;
+}
+
+
+static void
+set_high(adapt *a, uint64_t v, const char *why)
+{
+    if (write_high(a, v) < 0) return;
+
+    stats_event(a->pid, "memory.high",
+                "\"from\":%llu,\"to\":%llu,\"current\":%llu,\"why\":\"%s\"",
+                (unsigned long long)a->now, (unsigned long long)v,
+                (unsigned long long)current(a), why);
+
+    a->now     = v;
+    a->changed = now_ms();
+}
+
+
+int
+adapt_open(adapt *a, cgroup *cg, uint64_t min, uint64_t max)
+{
+    char trig[64];
+    int  r;
+
+    memset(a, 0, sizeof *a);
+    a->trig = a->high = a->cur = -1;
+    if (cgroup_version() != CGROUP_V2) return -ENOTSUP;
+
+    a->min  = min;
+    a->max  = max;
+
+    if ((a->high = cgroup_open(cg, "memory", "memory.high", O_WRONLY|O_CLOEXEC)) < 0 ||
+        (a->cur  = cgroup_open(cg, "memory", "memory.current", O_RDONLY|O_CLOEXEC)) < 0 ||
+        (a->trig = cgroup_open(cg, "memory", "memory.pressure", O_RDWR|O_NONBLOCK|O_CLOEXEC)) < 0) {
+        r = a->high < 0 ? a->high : a->cur < 0 ? a->cur : a->trig;
+        goto fail;
+    }
+
+    // The trigger lives as long as this fd; the NUL is part of it.
+    int n = snprintf(trig, sizeof trig, "some %d %d", ADAPT_STALL_US, ADAPT_WINDOW_US);
+    if (write(a->trig, trig, n + 1) < 0) {
+        r = -errno;
+        goto fail;
+    }
+
+    // The kid isn't here yet; nothing to log.
+    if ((r = write_high(a, max)) < 0) goto fail;
+    a->now     = max;
+    a->pressed = a->changed = now_ms();
+    return 0;
+
+fail:
+    adapt_close(a);
+    return r;
+}
+
+
+void
+adapt_pressure(adapt *a)
+{
+    uint64_t step = (a->max - a->min) / ADAPT_STEPS;
+    uint64_t v;
+
+    a->pressed = now_ms();
+
+    if (step < a->now / 4) step = a->now / 4;
+    v = a->now + step;
+    if (v > a->max) v = a->max;
+    if (v > a->now) set_high(a, v, "pressure");
+}
+
+
+void
+adapt_tick(adapt *a)
+{
+    uint64_t now = now_ms();
+    uint64_t v;
+
+    if (now - a->pressed < ADAPT_CALM_MS || now - a->changed < ADAPT_TICK_MS) return;
+
+    v = a->now - a->now / ADAPT_SHRINK;
+    if (v < a->min) v = a->min;
+    if (v < a->now) set_high(a, v, "calm");
+}
+
+
+void
+adapt_close(adapt *a)
+{
+    if (a->trig >= 0) close(a->trig);
+    if (a->high >= 0) close(a->high);
+    if (a->cur  >= 0) close(a->cur);
+    a->trig = a->high = a->cur = -1;
+}
+
+/* EOF */
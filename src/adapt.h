@@ -0,0 +1,90 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * adapt.h - memory.high driven by memory pressure (cgroup v2).
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+
+#ifndef ___ADAPT_H__Pq3vZ7kTn9XcRb2W___
+#define ___ADAPT_H__Pq3vZ7kTn9XcRb2W___ 1
+
+    /* Provide C linkage for symbols declared here .. */
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "cgroup.h"
+
+/*
+ * --memory-adapt=MIN:MAX keeps memory.high of a container between
+ * MIN and MAX bytes:
+ *
+ *  - it starts at MAX.
+ *  - a PSI trigger on memory.pressure fires when the container's
+ *    tasks stall on memory for ADAPT_STALL_US in any
+ *    ADAPT_WINDOW_US; memory.high is then raised by a quarter (at
+ *    least 1/ADAPT_STEPS of MAX-MIN).
+ *  - after ADAPT_CALM_MS without a trigger it is lowered by
+ *    1/ADAPT_SHRINK every ADAPT_TICK_MS -- down into the working
+ *    set, until reclaim makes it stall again.
+ *
+ * memory.high throttles and reclaims; it never OOM kills. Every
+ * change is logged as a JSON event (see stats_event()).
+ *
+ * The trigger fd is polled for POLLPRI (EPOLLPRI). Without
+ * CAP_SYS_RESOURCE the kernel only takes windows that are a
+ * multiple of 2s.
+ */
+
+#define ADAPT_STALL_US      200000
+#define ADAPT_WINDOW_US     2000000
+#define ADAPT_TICK_MS       1000
+#define ADAPT_CALM_MS       5000
+#define ADAPT_STEPS         16
+#define ADAPT_SHRINK        32
+
+struct adapt
+{
+    pid_t    pid;       // set by the caller; for the log
+    int      trig;      // memory.pressure with our trigger
+    int      high;      // memory.high
+    int      cur;       // memory.current
+    uint64_t min, max;
+    uint64_t now;       // current memory.high
+    uint64_t pressed;   // ms of the last trigger
+    uint64_t changed;   // ms of the last change
+};
+typedef struct adapt adapt;
+
+
+// Open the files of 'cg', arm the trigger and set memory.high to
+// 'max'. Needs cgroup v2. Returns 0 or -errno.
+extern int  adapt_open(adapt *a, cgroup *cg, uint64_t min, uint64_t max);
+
+// The trigger fired; raise memory.high.
+extern void adapt_pressure(adapt *a);
+
+// Call every ADAPT_TICK_MS; lowers memory.high of a calm container.
+extern void adapt_tick(adapt *a);
+
+extern void adapt_close(adapt *a);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* ! ___ADAPT_H__Pq3vZ7kTn9XcRb2W___ */
+
+/* EOF */
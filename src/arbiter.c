@@ -0,0 +1,181 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * arbiter.c - split a memory budget between containers.
+ *
+ * A fixed --memory per launch has no view of the host: the sum is
+ * either more than the RAM (and containers get OOM killed under
+ * load) or much less (and the device runs fewer containers than it
+ * could). Here the daemon has one budget and hands it out by
+ * priority, following the working sets; see arbiter.h.
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "stats.h"
+#include "arbiter.h"
+
+// A share without a MIN still gets this much to make progress
+#define ARBITER_FLOOR   (8 * 1024 * 1024)
+
+
+int
+share_open(share *s, cgroup *cg, int prio, uint64_t min, uint64_t max)
+{
+    int v2 = cgroup_version() == CGROUP_V2;
+    int r;
+
+    memset(s, 0, sizeof *s);
+    s->prio   = prio;
+    s->min    = min;
+    s->max    = max;
+    s->highfd = -1;
+
+    s->cur = cgroup_open(cg, "memory", v2 ? "memory.current" : "memory.usage_in_bytes",
+                         O_RDONLY|O_CLOEXEC);
+    if (s->cur < 0) return s->cur;
+
+    s->highfd = cgroup_open(cg, "memory", v2 ? "memory.high" : "memory.soft_limit_in_bytes",
+                            O_WRONLY|O_CLOEXEC);
+    if (s->highfd < 0) {
+        r = s->highfd;
+        goto fail;
+    }
+
+    if (v2 && (r = cgroup_write(cg, "memory", "memory.low", "%llu", (unsigned long long)min)) < 0)
+        goto fail;
+    return 0;
+
+fail:
+    share_close(s);
+    return r;
+}
+
+
+void
+share_close(share *s)
+{
+    if (s->cur >= 0)    close(s->cur);
+    if (s->highfd >= 0) close(s->highfd);
+    s->cur = s->highfd = -1;
+}
+
+
+static uint64_t
+usage(share *s)
+{
+    char buf[32];
+    ssize_t n = pread(s->cur, buf, sizeof buf - 1, 0);
+
+    if (n <= 0) return 0;
+    buf[n] = 0;
+    return strtoull(buf, 0, 10);
+}
+
+
+/*
+ * Hand out 'left' in proportion to priority, up to the 'want' of
+ * each share; what a share can't take goes to the others in the
+ * next round. Returns what is left over.
+ */
+static uint64_t
+fill(share **v, int n, uint64_t left)
+{
+    for (;;) {
+        uint64_t w = 0, given = 0;
+        int i, capped = 0;
+
+        for (i = 0; i < n; i++) {
+            if (v[i]->got < v[i]->want) w += v[i]->prio;
+        }
+        if (w == 0 || left == 0) return left;
+
+        for (i = 0; i < n; i++) {
+            share   *s = v[i];
+            uint64_t g = left / w * s->prio + left % w * s->prio / w;
+
+            if (s->got >= s->want) continue;
+            if (g >= s->want - s->got) {
+                g = s->want - s->got;
+                capped = 1;
+            }
+            s->got += g;
+            given  += g;
+        }
+        left -= given;
+        if (!capped) return left;
+    }
+}
+
+
+static void
+set_high(share *s, uint64_t v)
+{
+    char buf[32];
+    int  n = snprintf(buf, sizeof buf, "%llu", (unsigned long long)v);
+
+    if (write(s->highfd, buf, n) < 0) return;
+
+    stats_event(s->pid, "memory.share",
+                "\"prio\":%d,\"min\":%llu,\"max\":%llu,\"use\":%llu,\"from\":%llu,\"to\":%llu",
+                s->prio, (unsigned long long)s->min, (unsigned long long)s->max,
+                (unsigned long long)s->use, (unsigned long long)s->high,
+                (unsigned long long)v);
+    s->high = v;
+}
+
+
+void
+arbiter_split(share **v, int n, uint64_t budget)
+{
+    uint64_t left = budget;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        share   *s    = v[i];
+        uint64_t want;
+
+        s->use = usage(s);
+        s->got = s->min;
+        left  -= s->min < left ? s->min : left;
+
+        want = s->use + s->use / ARBITER_HEADROOM;
+        if (want < ARBITER_FLOOR) want = ARBITER_FLOOR;
+        if (want < s->min)        want = s->min;
+        if (want > s->max)        want = s->max;
+        s->want = want;
+    }
+
+    left = fill(v, n, left);
+
+    for (i = 0; i < n; i++) v[i]->want = v[i]->max;
+    fill(v, n, left);
+
+    for (i = 0; i < n; i++) {
+        share   *s = v[i];
+
+        // Even if the budget is gone
+        if (s->got < ARBITER_FLOOR) s->got = ARBITER_FLOOR;
+
+        uint64_t d = s->got > s->high ? s->got - s->high : s->high - s->got;
+
+        if (s->high == 0 || d > s->high / ARBITER_SLACK) set_high(s, s->got);
+    }
+}
+
+/* EOF */
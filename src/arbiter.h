@@ -0,0 +1,88 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * arbiter.h - split a memory budget between containers.
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+
+#ifndef ___ARBITER_H__Hc5mWq2Ls8TzKd4N___
+#define ___ARBITER_H__Hc5mWq2Ls8TzKd4N___ 1
+
+    /* Provide C linkage for symbols declared here .. */
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "cgroup.h"
+
+/*
+ * With --memory-budget=B the daemon owns B bytes and every
+ * container gets a share of it: a priority (a weight, 1-10000) and
+ * a MIN:MAX range. The launch is refused if the MINs no longer fit
+ * in B. Every ARBITER_TICK_MS, and whenever a container comes or
+ * goes, the budget is split again:
+ *
+ *  1. every container gets its MIN;
+ *  2. the rest goes out in proportion to priority, but no more than
+ *     the working set (memory usage + 1/ARBITER_HEADROOM) of each;
+ *  3. what is still left goes out the same way, up to each MAX.
+ *
+ * The result is written to memory.high and MIN to memory.low (v2)
+ * -- or to memory.soft_limit_in_bytes (v1; it has no memory.low).
+ * A container over its share is reclaimed down to it; one under
+ * its MIN is protected from reclaim for the others. Changes of
+ * less than 1/ARBITER_SLACK aren't written. Every change is logged
+ * as a JSON event (see stats_event()).
+ */
+
+#define ARBITER_TICK_MS     2000
+#define ARBITER_HEADROOM    4
+#define ARBITER_SLACK       32
+#define ARBITER_PRIO        100     // default priority
+
+struct share
+{
+    pid_t    pid;       // set by the caller; for the log
+    int      prio;
+    uint64_t min, max;
+
+    uint64_t use;       // memory usage at the last split
+    uint64_t want;      // per step 2 or 3 of the split
+    uint64_t got;       // share being handed out
+    uint64_t high;      // share last written; 0 if none
+
+    int      cur;       // memory.current or memory.usage_in_bytes
+    int      highfd;    // memory.high or memory.soft_limit_in_bytes
+};
+typedef struct share share;
+
+
+// Open the files of 'cg' and write memory.low (v2); do this before
+// the kid is attached. Returns 0 or -errno.
+extern int  share_open(share *s, cgroup *cg, int prio, uint64_t min, uint64_t max);
+
+extern void share_close(share *s);
+
+// Split 'budget' between the 'n' shares in 'v' and write the
+// results.
+extern void arbiter_split(share **v, int n, uint64_t budget);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* ! ___ARBITER_H__Hc5mWq2Ls8TzKd4N___ */
+
+/* EOF */
@@ -0,0 +1,229 @@
+#! /bin/bash
+
+#
+# Container startup latency benchmark for 'ns'.
+#
+# Builds a busybox root (via mk-test-root.sh) and launches
+# containers in a loop for each configuration below. Every
+# container runs /bin/true as its init; so the measured wall time
+# ('total') is the full cost of creating, starting and tearing down
+# one container. The per-phase numbers come from 'ns --trace'; each
+# phase is the time since the previous event on the startup
+# timeline.
+#
+# Usage: bench.sh path/to/ns [rootdir]
+#
+# Environment:
+#   N       number of launches per configuration [100]
+#   CONFIGS space separated list of configurations to run
+#           [base hook legacy net veth pool user idmap mem overlay zygote
+#            freeze]
+#           'hook' is 'base' with the pre-exec script replaced by
+#           examples/hook.c (built with $CC) loaded via --hook.
+#           'legacy' is 'base' with the container's mounts set up by
+#           mount(2) path by path (--legacy-mount) for comparison.
+#           'image' (a squashfs of the root) needs mksquashfs.
+#           'freeze' isn't a launch: one daemon container running
+#           sleep(1) is frozen and thawed N times ('ns freeze' and
+#           'ns thaw'); its phases are 'freeze' and 'thaw' -- the
+#           alternative to a 'zygote' cold start for a container
+#           that was put in the background.
+#
+# Output is one JSON object per line on stdout:
+#
+#   {"config":"net","phase":"clone","n":100,"p50_us":..,"p99_us":..,"max_us":..}
+#
+# Diagnostics go to stderr. Needs root privileges.
+#
+
+Z=$0
+bb=/bin/busybox
+
+die() {
+    echo "$Z: $@" 1>&2
+    exit 1
+}
+
+warn() {
+    echo "$Z: $@" 1>&2
+}
+
+[ -n "$1" ] || die "Usage: $Z path/to/ns [rootdir]"
+
+exe=$(realpath $1)
+root=${2:-/tmp/zzbench}
+N=${N:-100}
+CONFIGS=${CONFIGS:-"base hook legacy net veth pool user idmap mem overlay zygote freeze"}
+
+[ -x "$exe" ]    || die "can't find executable $exe"
+[ $(id -u) -eq 0 ] || die "Need root privileges to run"
+
+if [ ! -d $root ]; then
+    (cd $(dirname $0) && ./mk-test-root.sh $root) 1>&2 || die "can't make rootfs $root"
+fi
+
+tmp=$(mktemp -d /tmp/nsbench.XXXXXX) || die "can't make tempdir"
+tr=$tmp/trace.json
+pool=$tmp/netns
+mkdir -p $tmp/merged
+zsock=$tmp/ctl.sock
+zpid=
+sleeper=/freeze-init.sh
+trap "[ -n \"\$zpid\" ] && kill \$zpid; $exe -P $pool netpool 0; rm -rf $tmp $root$sleeper" EXIT
+
+# uid/gid that container root is mapped to for the 'user' config
+nobody=65534
+
+# Print the ns options for a named configuration
+opts() {
+    case $1 in
+        base) echo "" ;;
+        hook) echo "-H $tmp/ns-hook.so" ;;
+        legacy) echo "-M" ;;
+        net)  echo "-n" ;;
+        # The kernel deletes a veth pair asynchronously after its
+        # netns goes away; so each launch uses unique names.
+        veth) echo "-e nsb$2:eth0,10.99.88.2/24,10.99.88.1" ;;
+        pool) echo "-P $pool -e nsb$2:eth0,10.99.88.2/24,10.99.88.1" ;;
+        user) echo "-u" ;;
+        idmap) echo "-u -i" ;;
+        mem)  echo "-m 64M" ;;
+        overlay) echo "-L $root -U $tmp/upper/$2" ;;
+        image)   echo "-I $tmp/root.sqfs" ;;
+        zygote)  echo "" ;;
+        # Only containers with a cgroup can be frozen
+        freeze)  echo "-m 64M" ;;
+        *)    die "unknown config $1" ;;
+    esac
+}
+
+# Print the trailing args (if any) for a named configuration
+xargs_for() {
+    case $1 in
+        user|idmap) echo "$nobody $nobody" ;;
+        *)    echo "" ;;
+    esac
+}
+
+# now in microseconds
+now_us() {
+    local t=$(date +%s%N)
+    echo $(( t / 1000 ))
+}
+
+# report CONFIG PHASE FILE
+#
+# FILE has one sample (in microseconds) per line.
+report() {
+    sort -n $3 | awk -v cfg=$1 -v ph=$2 '
+        { v[NR] = $1 }
+        END {
+            if (NR == 0) exit
+            p50 = v[int((NR - 1) * 0.50) + 1]
+            p99 = v[int((NR - 1) * 0.99) + 1]
+            printf "{\"config\":\"%s\",\"phase\":\"%s\",\"n\":%d,\"p50_us\":%d,\"p99_us\":%d,\"max_us\":%d}\n",
+                   cfg, ph, NR, p50, p99, v[NR]
+        }'
+}
+
+# launch CONFIG I: start one container and write its trace to $tr
+launch() {
+    case $1 in
+        zygote)  $exe launch $zsock $root/pre.sh $root /bin/true ;;
+        overlay|image) $exe $(opts $1 $2) -t $tr $root/pre.sh $tmp/merged /bin/true ;;
+        *)       $exe $(opts $1 $2) -t $tr $root/pre.sh $root /bin/true $(xargs_for $1) ;;
+    esac
+}
+
+# measure CONFIG
+measure() {
+    local cfg=$1
+    local out=$tmp/$cfg.total
+    local i=0
+
+    rm -f $tmp/$cfg.*
+    : > $out
+    while [ $i -lt $N ]; do
+        local t0=$(now_us)
+        launch $cfg $i 1>/dev/null || die "launch $i of config $cfg failed"
+        local t1=$(now_us)
+
+        echo $(( t1 - t0 )) >> $out
+
+        # one event per line: {"who":..,"phase":"clone",..,"dt_ns":1234}
+        awk -v pfx=$tmp/$cfg. -F'"' '/"phase"/ {
+                dt = $0; sub(/.*"dt_ns":/, "", dt); sub(/[^0-9].*/, "", dt)
+                print int(dt / 1000) >> (pfx $8)
+            }' $tr
+        i=$(( i + 1 ))
+    done
+
+    # phases in timeline order of the last trace
+    for ph in $(awk -F'"' '/"phase"/ { print $8 }' $tr); do
+        report $cfg $ph $tmp/$cfg.$ph
+    done
+    report $cfg total $out
+}
+
+# measure_freeze: freeze and thaw one daemon container N times
+measure_freeze() {
+    local id
+    local i=0
+    local s
+
+    id=$($exe launch $zsock - $root $sleeper) || die "can't launch a container to freeze"
+
+    rm -f $tmp/freeze.*
+    while [ $i -lt $N ]; do
+        # "ID frozen in N us"
+        s=$($exe freeze $id) || die "freeze $i of container $id failed"
+        echo $s | awk '{ print $4 }' >> $tmp/freeze.freeze
+
+        s=$($exe thaw $id) || die "thaw $i of container $id failed"
+        echo $s | awk '{ print $4 }' >> $tmp/freeze.thaw
+        i=$(( i + 1 ))
+    done
+
+    $exe stop $zsock $id 1>/dev/null
+    report freeze freeze $tmp/freeze.freeze
+    report freeze thaw $tmp/freeze.thaw
+}
+
+for c in $CONFIGS; do
+    # Pre-fill the netns pool; launches refill it in the background
+    [ $c = pool ] && $exe -P $pool netpool $N
+
+    if [ $c = hook ]; then
+        ${CC:-cc} -O2 -shared -fPIC -I$(dirname $0) -o $tmp/ns-hook.so $(dirname $0)/../examples/hook.c || die "can't build hook"
+    fi
+
+    if [ $c = image ]; then
+        mksquashfs $root $tmp/root.sqfs -noappend -quiet 1>&2 || die "can't make squashfs of $root"
+    fi
+
+    if [ $c = freeze ]; then
+        printf '#! /bin/sh\nexec sleep 3600\n' > $root$sleeper
+        chmod 755 $root$sleeper
+    fi
+
+    # The daemon replies once the container exec's init
+    if [ $c = zygote ] || [ $c = freeze ]; then
+        $exe -t $tr $(opts $c) daemon $zsock &
+        zpid=$!
+        while [ ! -S $zsock ]; do sleep 0.1; done
+    fi
+
+    if [ $c = freeze ]; then
+        warn "freezing and thawing a container $N times .."
+        measure_freeze
+    else
+        warn "running $N launches of config '$c' .."
+        measure $c
+    fi
+
+    if [ -n "$zpid" ]; then
+        kill $zpid
+        wait $zpid
+        zpid=
+    fi
+done
@@ -0,0 +1,450 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * cgroup.c - per-container cgroups on the v1 or v2 hierarchy.
+ *
+ * On v2 the cgroup is made and configured before clone; the kid is
+ * then cloned straight into it (see spawn_child()) and is charged
+ * from its first page. On v1 a directory is made per controller on
+ * first use and the kid is moved into them after clone.
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "cgroup.h"
+
+extern int mkdirhier(const char *dir, mode_t mode);
+
+#define V1ROOT  "/sys/fs/cgroup"
+
+// v1 controllers we know of; the index is the bit in v1mask.
+static const char *V1ctl[] = { "memory", "cpu", "cpuset", "blkio", "freezer", "cpuacct", 0 };
+
+static const char *V2root = 0;
+
+static int v1_dir(cgroup *cg, const char *ctl, char *path, size_t n);
+
+
+// True if v1 has a freezer hierarchy; not every kernel (or Android
+// image) mounts one.
+static int
+v1_freezer(void)
+{
+    return 0 == access(V1ROOT "/freezer/tasks", F_OK);
+}
+
+
+int
+cgroup_version(void)
+{
+    static int v = 0;
+
+    if (v) return v;
+
+    if (0 == access("/sys/fs/cgroup/cgroup.controllers", F_OK)) {
+        V2root = "/sys/fs/cgroup";
+    } else if (0 != access(V1ROOT "/memory/memory.limit_in_bytes", F_OK) &&
+               0 == access("/sys/fs/cgroup/unified/cgroup.controllers", F_OK)) {
+        V2root = "/sys/fs/cgroup/unified";
+    }
+
+    v = V2root ? CGROUP_V2 : CGROUP_V1;
+    return v;
+}
+
+
+/*
+ * Write a string to an open cgroup file in one write(2); the kernel
+ * parses each write on its own.
+ */
+static int
+writefd(int fd, const char *buf, size_t n)
+{
+    int r = write(fd, buf, n) == (ssize_t)n ? 0 : -errno;
+
+    close(fd);
+    return r;
+}
+
+
+static int
+writefile(const char *path, const char *str)
+{
+    int fd = open(path, O_WRONLY|O_CLOEXEC);
+
+    if (fd < 0) return -errno;
+    return writefd(fd, str, strlen(str));
+}
+
+
+/*
+ * Enable the v2 controllers for our cgroups: every controller the
+ * root has is turned on in the root and in CGROUP_PARENT. The
+ * parent itself has no processes; so this doesn't run foul of the
+ * "no internal processes" rule.
+ */
+static int
+v2_parent(void)
+{
+    static const char *ctl[] = { "+memory", "+cpu", "+cpuset", "+io", "+pids", 0 };
+    static int ready = 0;
+    char path[PATH_MAX];
+    const char **c;
+
+    if (ready) return 0;
+
+    snprintf(path, sizeof path, "%s/%s", V2root, CGROUP_PARENT);
+    if (mkdir(path, 0755) < 0 && errno != EEXIST) return -errno;
+
+    // Not all controllers are present everywhere; ignore failures.
+    for (c = ctl; *c; c++) {
+        snprintf(path, sizeof path, "%s/cgroup.subtree_control", V2root);
+        writefile(path, *c);
+
+        snprintf(path, sizeof path, "%s/%s/cgroup.subtree_control", V2root, CGROUP_PARENT);
+        writefile(path, *c);
+    }
+
+    ready = 1;
+    return 0;
+}
+
+
+int
+cgroup_create(cgroup *cg, const char *name)
+{
+    char path[PATH_MAX];
+    int r;
+
+    memset(cg, 0, sizeof *cg);
+    cg->fd = -1;
+    snprintf(cg->name, sizeof cg->name, "%s", name);
+
+    /*
+     * Every container can be frozen if there is a freezer; see
+     * cgroup_freeze(). Its limits don't depend on that.
+     */
+    if (cgroup_version() == CGROUP_V1) {
+        if (v1_freezer()) v1_dir(cg, "freezer", path, sizeof path);
+        return 0;
+    }
+
+    if ((r = v2_parent()) < 0) return r;
+
+    snprintf(path, sizeof path, "%s/%s/%s", V2root, CGROUP_PARENT, name);
+    if (mkdir(path, 0755) < 0 && errno != EEXIST) return -errno;
+
+    cg->fd = open(path, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    return cg->fd < 0 ? -errno : 0;
+}
+
+
+/*
+ * Read a small cgroup file into 'buf' without the trailing newline.
+ */
+static int
+readfile(const char *path, char *buf, size_t n)
+{
+    int fd = open(path, O_RDONLY|O_CLOEXEC);
+    ssize_t m;
+
+    if (fd < 0) return -errno;
+
+    m = read(fd, buf, n-1);
+    close(fd);
+    if (m < 0) return -errno;
+
+    while (m > 0 && buf[m-1] == '\n') m--;
+    buf[m] = 0;
+    return m;
+}
+
+
+/*
+ * A new v1 cpuset has no cpus and mems; no task can join it until
+ * they are set. Copy them from the parent 'dir/..' unless set.
+ */
+static void
+v1_cpuset_init(const char *dir)
+{
+    static const char *files[] = { "cpuset.cpus", "cpuset.mems", 0 };
+    char path[PATH_MAX];
+    char buf[1024];
+    const char **f;
+
+    for (f = files; *f; f++) {
+        snprintf(path, sizeof path, "%s/%s", dir, *f);
+        if (readfile(path, buf, sizeof buf) != 0) continue;
+
+        snprintf(path, sizeof path, "%s/../%s", dir, *f);
+        if (readfile(path, buf, sizeof buf) <= 0) continue;
+
+        snprintf(path, sizeof path, "%s/%s", dir, *f);
+        writefile(path, buf);
+    }
+}
+
+
+/*
+ * Return the v1 directory of controller 'ctl' in 'path'; make it
+ * if needed.
+ */
+static int
+v1_dir(cgroup *cg, const char *ctl, char *path, size_t n)
+{
+    int i, r;
+
+    for (i = 0; V1ctl[i]; i++) {
+        if (0 == strcmp(V1ctl[i], ctl)) break;
+    }
+    if (!V1ctl[i]) return -EINVAL;
+
+    snprintf(path, n, "%s/%s/%s/%s", V1ROOT, ctl, CGROUP_PARENT, cg->name);
+    if (!(cg->v1mask & (1 << i))) {
+        if ((r = mkdirhier(path, 0755)) < 0) return r;
+        cg->v1mask |= 1 << i;
+
+        if (0 == strcmp(ctl, "cpuset")) {
+            char par[PATH_MAX];
+
+            snprintf(par, sizeof par, "%s/cpuset/%s", V1ROOT, CGROUP_PARENT);
+            v1_cpuset_init(par);
+            v1_cpuset_init(path);
+        }
+    }
+    return 0;
+}
+
+
+int
+cgroup_write(cgroup *cg, const char *ctl, const char *file, const char *fmt, ...)
+{
+    char buf[256];
+    va_list ap;
+    int fd, n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(buf, sizeof buf, fmt, ap);
+    va_end(ap);
+    if (n >= (int)sizeof buf) return -E2BIG;
+
+    if ((fd = cgroup_open(cg, ctl, file, O_WRONLY)) < 0) return fd;
+    return writefd(fd, buf, n);
+}
+
+
+int
+cgroup_open(cgroup *cg, const char *ctl, const char *file, int flags)
+{
+    char path[PATH_MAX];
+    int fd, r;
+
+    if (cg->fd >= 0) {
+        fd = openat(cg->fd, file, flags|O_CLOEXEC);
+    } else {
+        if ((r = v1_dir(cg, ctl, path, sizeof path)) < 0) return r;
+
+        size_t m = strlen(path);
+        snprintf(path+m, sizeof path - m, "/%s", file);
+        fd = open(path, flags|O_CLOEXEC);
+    }
+    return fd < 0 ? -errno : fd;
+}
+
+
+int
+cgroup_attach(cgroup *cg, pid_t pid)
+{
+    char path[PATH_MAX];
+    char buf[32];
+    int i, r;
+
+    snprintf(buf, sizeof buf, "%d", pid);
+
+    if (cg->fd >= 0) {
+        int fd = openat(cg->fd, "cgroup.procs", O_WRONLY|O_CLOEXEC);
+        if (fd < 0) return -errno;
+        return writefd(fd, buf, strlen(buf));
+    }
+
+    for (i = 0; V1ctl[i]; i++) {
+        if (!(cg->v1mask & (1 << i))) continue;
+
+        snprintf(path, sizeof path, "%s/%s/%s/%s/cgroup.procs", V1ROOT, V1ctl[i], CGROUP_PARENT, cg->name);
+        if ((r = writefile(path, buf)) < 0) return r;
+    }
+    return 0;
+}
+
+
+void
+cgroup_destroy(cgroup *cg)
+{
+    char path[PATH_MAX];
+    int i;
+
+    if (!cg->name[0]) return;
+
+    if (cg->fd >= 0) {
+        close(cg->fd);
+        snprintf(path, sizeof path, "%s/%s/%s", V2root, CGROUP_PARENT, cg->name);
+        rmdir(path);
+    }
+
+    for (i = 0; V1ctl[i]; i++) {
+        if (!(cg->v1mask & (1 << i))) continue;
+
+        snprintf(path, sizeof path, "%s/%s/%s/%s", V1ROOT, V1ctl[i], CGROUP_PARENT, cg->name);
+        rmdir(path);
+    }
+
+    memset(cg, 0, sizeof *cg);
+    cg->fd = -1;
+}
+
+
+static uint64_t
+now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/*
+ * Name the directory of container cgroup 'name' that has the
+ * freezer in 'dir'.
+ */
+static void
+freezer_dir(char *dir, size_t n, const char *name)
+{
+    if (cgroup_version() == CGROUP_V2)
+        snprintf(dir, n, "%s/%s/%s", V2root, CGROUP_PARENT, name);
+    else
+        snprintf(dir, n, "%s/freezer/%s/%s", V1ROOT, CGROUP_PARENT, name);
+}
+
+
+/*
+ * v2 has cgroup.freeze and tells when all processes are frozen in
+ * cgroup.events (which polls for POLLPRI on changes); v1 has
+ * freezer.state which is FREEZING until they are.
+ */
+int
+cgroup_freeze(const char *name, int on, int ms)
+{
+    int v2 = cgroup_version() == CGROUP_V2;
+    const char *want = v2 ? (on ? "frozen 1" : "frozen 0") : (on ? "FROZEN" : "THAWED");
+    uint64_t end = now_us() + (uint64_t)ms * 1000;
+    char dir[PATH_MAX], path[PATH_MAX+32], buf[256];
+    int fd, r;
+
+    if (!v2 && !v1_freezer()) return -ENOTSUP;
+
+    freezer_dir(dir, sizeof dir, name);
+
+    snprintf(path, sizeof path, "%s/%s", dir, v2 ? "cgroup.freeze" : "freezer.state");
+    if ((r = writefile(path, v2 ? (on ? "1" : "0") : want)) < 0) return r;
+
+    if (v2) snprintf(path, sizeof path, "%s/cgroup.events", dir);
+    if ((fd = open(path, O_RDONLY|O_CLOEXEC)) < 0) return -errno;
+
+    for (;;) {
+        ssize_t  n   = pread(fd, buf, sizeof buf - 1, 0);
+        uint64_t now = now_us();
+
+        if (n < 0) {
+            r = -errno;
+            break;
+        }
+        buf[n] = 0;
+        if (strstr(buf, want)) {
+            r = 0;
+            break;
+        }
+        if (now >= end) {
+            r = -ETIMEDOUT;
+            break;
+        }
+
+        if (v2) {
+            struct pollfd pfd = { .fd = fd, .events = POLLPRI };
+
+            poll(&pfd, 1, (int)((end - now + 999) / 1000));
+        } else {
+            usleep(100);
+        }
+    }
+    close(fd);
+    return r;
+}
+
+
+int
+cgroup_frozen(const char *name)
+{
+    int v2 = cgroup_version() == CGROUP_V2;
+    char dir[PATH_MAX], path[PATH_MAX+32], buf[256];
+    int r;
+
+    if (!v2 && !v1_freezer()) return -ENOTSUP;
+
+    freezer_dir(dir, sizeof dir, name);
+    snprintf(path, sizeof path, "%s/%s", dir, v2 ? "cgroup.events" : "freezer.state");
+    if ((r = readfile(path, buf, sizeof buf)) < 0) return r;
+
+    return strstr(buf, v2 ? "frozen 1" : "FROZEN") != 0;
+}
+
+
+void
+cgroup_scan(const char *ctl, const char *file,
+            void (*fn)(const char *val, void *arg), void *arg)
+{
+    char dir[PATH_MAX];
+    char path[2 * PATH_MAX];
+    char buf[1024];
+    struct dirent *de;
+    DIR *d;
+
+    if (cgroup_version() == CGROUP_V2)
+        snprintf(dir, sizeof dir, "%s/%s", V2root, CGROUP_PARENT);
+    else
+        snprintf(dir, sizeof dir, "%s/%s/%s", V1ROOT, ctl, CGROUP_PARENT);
+
+    if (!(d = opendir(dir))) return;
+
+    while ((de = readdir(d))) {
+        if (de->d_type != DT_DIR || de->d_name[0] == '.') continue;
+
+        snprintf(path, sizeof path, "%s/%s/%s", dir, de->d_name, file);
+        if (readfile(path, buf, sizeof buf) > 0) fn(buf, arg);
+    }
+    closedir(d);
+}
+
+/* EOF */
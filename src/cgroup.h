@@ -0,0 +1,97 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * cgroup.h - per-container cgroups on the v1 or v2 hierarchy.
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+
+#ifndef ___CGROUP_H__Rw4nTq8ZbK2xVe7L___
+#define ___CGROUP_H__Rw4nTq8ZbK2xVe7L___ 1
+
+    /* Provide C linkage for symbols declared here .. */
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <sys/types.h>
+
+/*
+ * Each container gets a cgroup named NAME under CGROUP_PARENT:
+ *
+ *   v1: /sys/fs/cgroup/CONTROLLER/ns/NAME (made on first use)
+ *   v2: V2ROOT/ns/NAME
+ *
+ * where V2ROOT is /sys/fs/cgroup on a v2-only host, or
+ * /sys/fs/cgroup/unified on a hybrid host whose v1 memory
+ * controller isn't mounted.
+ */
+
+#define CGROUP_PARENT   "ns"
+
+#define CGROUP_V1   1
+#define CGROUP_V2   2
+
+struct cgroup
+{
+    char     name[32];
+    int      fd;        // v2: open cgroup directory; -1 otherwise
+    unsigned v1mask;    // v1: controllers whose directory we made
+};
+typedef struct cgroup cgroup;
+
+// Return CGROUP_V1 or CGROUP_V2
+extern int  cgroup_version(void);
+
+// Make the cgroup 'name'; on v2 the directory is opened for
+// clone3(CLONE_INTO_CGROUP). Returns 0 or -errno.
+extern int  cgroup_create(cgroup *cg, const char *name);
+
+// Write a value to 'file' of controller 'ctl' (e.g., "memory",
+// "memory.max"). Returns 0 or -errno.
+extern int  cgroup_write(cgroup *cg, const char *ctl, const char *file, const char *fmt, ...)
+                __attribute__((format(printf, 4, 5)));
+
+// Open 'file' of controller 'ctl' with open(2) 'flags'; on v1 the
+// controller's directory is made if needed -- before the kid is
+// attached. Returns the fd or -errno.
+extern int  cgroup_open(cgroup *cg, const char *ctl, const char *file, int flags);
+
+// Move 'pid' into the cgroup. Returns 0 or -errno.
+extern int  cgroup_attach(cgroup *cg, pid_t pid);
+
+// Remove the cgroup; its processes must have exited.
+extern void cgroup_destroy(cgroup *cg);
+
+// Freeze ('on') or thaw the processes in container cgroup 'name'
+// (made by any 'ns' process) and wait up to 'ms' until they are.
+// A frozen container uses no cpu; its memory stays as it is.
+// Returns 0 or -errno (-ENOENT if there is no such cgroup,
+// -ENOTSUP on v1 without a freezer hierarchy).
+extern int  cgroup_freeze(const char *name, int on, int ms);
+
+// Return 1 if container cgroup 'name' is frozen, 0 if not or
+// -errno.
+extern int  cgroup_frozen(const char *name);
+
+// Call fn() with the contents of 'file' of controller 'ctl' in
+// every container cgroup (including ones made by other 'ns'
+// processes).
+extern void cgroup_scan(const char *ctl, const char *file,
+                        void (*fn)(const char *val, void *arg), void *arg);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* ! ___CGROUP_H__Rw4nTq8ZbK2xVe7L___ */
+
+/* EOF */
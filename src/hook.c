@@ -0,0 +1,56 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * hook.c - in-process pre-exec hooks.
+ *
+ * The pre-exec script costs a fork+exec of a shell per launch, and
+ * usually more for the tools it runs. A hook is the same work in a
+ * shared object: it is dlopen'd once and called directly.
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <dlfcn.h>
+
+#include "hook.h"
+
+static ns_pre_exec_fn *Pre_exec;
+
+
+int
+hook_load(const char *path, char *err, size_t n)
+{
+    void *h = dlopen(path, RTLD_NOW|RTLD_LOCAL);
+
+    if (!h) {
+        snprintf(err, n, "can't load hook: %s", dlerror());
+        return -1;
+    }
+
+    // POSIX: a function pointer can be converted to and from void *
+    *(void **)&Pre_exec = dlsym(h, "ns_pre_exec");
+    if (!Pre_exec) {
+        snprintf(err, n, "hook %s has no ns_pre_exec()", path);
+        dlclose(h);
+        return -1;
+    }
+    return 0;
+}
+
+
+int
+hook_pre_exec(pid_t pid, int flags, const struct ns_hook_config *cfg)
+{
+    return Pre_exec ? (*Pre_exec)(pid, flags, cfg) : -ENOSYS;
+}
+
+/* EOF */
@@ -0,0 +1,74 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * hook.h - in-process pre-exec hooks.
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+
+#ifndef ___HOOK_H__Tq7dN3wXk9PzRb5M___
+#define ___HOOK_H__Tq7dN3wXk9PzRb5M___ 1
+
+    /* Provide C linkage for symbols declared here .. */
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * A hook is a shared object (--hook) that does the work of the
+ * pre-exec script without creating a process. It is loaded once
+ * and exports:
+ *
+ *      int ns_pre_exec(pid_t pid, int flags, const struct ns_hook_config *cfg);
+ *
+ * It runs in the parent (the daemon, in daemon mode) after the kid
+ * 'pid' is cloned, and before it is released; 'flags' are the
+ * CLONE_NEW* namespaces of the container. It returns 0 when done,
+ * NS_HOOK_SCRIPT to have the pre-exec script run after it (e.g.,
+ * for cases it doesn't handle) or -errno to fail the launch.
+ *
+ * A hook blocks its caller: the daemon doesn't serve other requests
+ * while it runs; and --pre-timeout doesn't apply.
+ */
+
+#define NS_HOOK_VERSION     1
+#define NS_HOOK_SCRIPT      1
+
+struct ns_hook_config
+{
+    int         version;    // NS_HOOK_VERSION
+    const char *rootfs;
+    const char *init;
+    const char *pool_veth;  // host end of a pooled netns' veth pair or 0
+    int         veth;       // 1 if ns plumbed a veth pair (--veth)
+    int         uid, gid;   // container root is mapped to these (--user)
+};
+
+typedef int ns_pre_exec_fn(pid_t pid, int flags, const struct ns_hook_config *cfg);
+
+
+// Load the hook in 'path'. Returns 0 on success and -1 (with the
+// reason in 'err') on failure.
+extern int hook_load(const char *path, char *err, size_t n);
+
+// Call the loaded hook's ns_pre_exec()
+extern int hook_pre_exec(pid_t pid, int flags, const struct ns_hook_config *cfg);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* ! ___HOOK_H__Tq7dN3wXk9PzRb5M___ */
+
+/* EOF */
@@ -0,0 +1,196 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * idle.c - reclaim the memory of idle containers.
+ *
+ * A container that sits in the background keeps its page cache
+ * and anon memory until the host runs short and the kernel has to
+ * find it -- with everyone waiting. Here, it is reclaimed as soon
+ * as the container goes quiet; see idle.h.
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "trace.h"
+#include "stats.h"
+#include "idle.h"
+
+
+static uint64_t
+now_ms(void)
+{
+    return trace_now() / 1000000;
+}
+
+
+static ssize_t
+readfd(int fd, char *buf, size_t n)
+{
+    ssize_t m = pread(fd, buf, n - 1, 0);
+
+    if (m < 0) return -errno;
+    buf[m] = 0;
+    return m;
+}
+
+
+// cpu usage in usec
+static uint64_t
+cpu_usage(idle *d)
+{
+    char buf[512];
+    char *p;
+
+    if (readfd(d->cpu, buf, sizeof buf) <= 0) return 0;
+
+    if (cgroup_version() == CGROUP_V1) return strtoull(buf, 0, 10) / 1000;
+
+    if (!(p = strstr(buf, "usage_usec "))) return 0;
+    return strtoull(p + 11, 0, 10);
+}
+
+
+static uint64_t
+mem_usage(idle *d)
+{
+    char buf[32];
+
+    if (readfd(d->cur, buf, sizeof buf) <= 0) return 0;
+    return strtoull(buf, 0, 10);
+}
+
+
+int
+idle_open(idle *d, cgroup *cg)
+{
+    int v2 = cgroup_version() == CGROUP_V2;
+    int r;
+
+    memset(d, 0, sizeof *d);
+    d->cpu = d->cur = d->rec = -1;
+
+    if (v2) {
+        d->cpu = cgroup_open(cg, "cpu", "cpu.stat", O_RDONLY|O_CLOEXEC);
+        d->cur = cgroup_open(cg, "memory", "memory.current", O_RDONLY|O_CLOEXEC);
+        d->rec = cgroup_open(cg, "memory", "memory.reclaim", O_WRONLY|O_CLOEXEC);
+    } else {
+        d->cpu = cgroup_open(cg, "cpuacct", "cpuacct.usage", O_RDONLY|O_CLOEXEC);
+        d->cur = cgroup_open(cg, "memory", "memory.usage_in_bytes", O_RDONLY|O_CLOEXEC);
+        d->rec = cgroup_open(cg, "memory", "memory.limit_in_bytes", O_RDWR|O_CLOEXEC);
+    }
+
+    if (d->cpu < 0 || d->cur < 0 || d->rec < 0) {
+        r = d->cpu < 0 ? d->cpu : d->cur < 0 ? d->cur : d->rec;
+        idle_close(d);
+        return r;
+    }
+
+    d->usage = cpu_usage(d);
+    d->tick  = now_ms();
+    return 0;
+}
+
+
+void
+idle_close(idle *d)
+{
+    if (d->cpu >= 0) close(d->cpu);
+    if (d->cur >= 0) close(d->cur);
+    if (d->rec >= 0) close(d->rec);
+    d->cpu = d->cur = d->rec = -1;
+}
+
+
+/*
+ * Ask the kernel to reclaim 'n' bytes. v1 has no memory.reclaim;
+ * a limit below the usage makes it reclaim down to that limit (or
+ * give up with EBUSY) before the write returns.
+ */
+static void
+reclaim(idle *d, uint64_t n)
+{
+    char buf[32], old[32];
+    int  v2 = cgroup_version() == CGROUP_V2;
+    uint64_t use = mem_usage(d);
+
+    if (v2) {
+        int m = snprintf(buf, sizeof buf, "%llu", (unsigned long long)n);
+
+        // EAGAIN: less than 'n' could be reclaimed
+        if (write(d->rec, buf, m) < 0 && errno != EAGAIN) return;
+    } else {
+        if (readfd(d->rec, old, sizeof old) <= 0) return;
+
+        int m = snprintf(buf, sizeof buf, "%llu", (unsigned long long)(use - n));
+        if (write(d->rec, buf, m) < 0 && errno != EBUSY) return;
+        if (write(d->rec, old, strlen(old)) < 0) return;
+    }
+
+    uint64_t now = mem_usage(d);
+    uint64_t got = use > now ? use - now : 0;
+
+    d->spell += got;
+    d->total += got;
+    if (got < IDLE_LEAST) d->done = 1;
+
+    stats_event(d->pid, "reclaim",
+                "\"how\":\"%s\",\"asked\":%llu,\"reclaimed\":%llu,\"use\":%llu,\"total\":%llu",
+                v2 ? "memory.reclaim" : "limit", (unsigned long long)n,
+                (unsigned long long)got, (unsigned long long)now,
+                (unsigned long long)d->total);
+}
+
+
+void
+idle_tick(idle *d, int ms)
+{
+    uint64_t now   = now_ms();
+    uint64_t usage = cpu_usage(d);
+    uint64_t busy  = usage - d->usage;
+    uint64_t span  = now - d->tick;
+
+    d->usage = usage;
+    d->tick  = now;
+
+    // usec of cpu per ms of wall clock is permille of one cpu
+    if (busy > span * IDLE_PERMILLE) {
+        if (d->idle)
+            stats_event(d->pid, "idle", "\"state\":\"active\",\"idle_ms\":%llu,\"reclaimed\":%llu",
+                        (unsigned long long)(now - d->quiet), (unsigned long long)d->spell);
+
+        d->quiet = 0;
+        d->idle  = d->done = 0;
+        d->spell = 0;
+        return;
+    }
+
+    if (d->quiet == 0) d->quiet = now - span;
+    if (now - d->quiet < (uint64_t)ms) return;
+
+    if (!d->idle) {
+        d->idle = 1;
+        stats_event(d->pid, "idle", "\"state\":\"idle\",\"idle_ms\":%llu,\"after_ms\":%d,"
+                    "\"permille\":%d,\"reclaimed\":0",
+                    (unsigned long long)(now - d->quiet), ms, IDLE_PERMILLE);
+    }
+
+    uint64_t use = mem_usage(d);
+    if (!d->done && use / IDLE_STEP > 0) reclaim(d, use / IDLE_STEP);
+}
+
+/* EOF */
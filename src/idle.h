@@ -0,0 +1,90 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * idle.h - reclaim the memory of idle containers.
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+
+#ifndef ___IDLE_H__Nw8cQj3Ty6PgVm5D___
+#define ___IDLE_H__Nw8cQj3Ty6PgVm5D___ 1
+
+    /* Provide C linkage for symbols declared here .. */
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "cgroup.h"
+
+/*
+ * With --idle-reclaim=T the cpu usage of every container is looked
+ * at every IDLE_TICK_MS (cpu.stat usage_usec on v2, cpuacct.usage
+ * on v1). A container that used less than IDLE_PERMILLE of a cpu
+ * for T ms is idle; from then on, every tick asks the kernel to
+ * reclaim 1/IDLE_STEP of its memory:
+ *
+ *   v2: a write to memory.reclaim;
+ *   v1: memory.limit_in_bytes is set that much below the usage and
+ *       put back right after.
+ *
+ * Once a tick frees less than IDLE_LEAST, what is left is hot (or
+ * anon without swap) and the container is left alone until it
+ * wakes up and goes idle again. Each reclaim is synchronous.
+ *
+ * Events (see stats_event()):
+ *
+ *   "idle"    {"state":"idle","idle_ms":N,"after_ms":T,"permille":N,..}
+ *             {"state":"active","idle_ms":N,"reclaimed":N}
+ *   "reclaim" {"how":"memory.reclaim"|"limit","asked":N,
+ *              "reclaimed":N,"use":N,"total":N}
+ */
+
+#define IDLE_TICK_MS    1000
+#define IDLE_PERMILLE   10
+#define IDLE_STEP       4
+#define IDLE_LEAST      (1024 * 1024)
+
+struct idle
+{
+    pid_t    pid;       // set by the caller; for the log
+    int      cpu;       // cpu.stat or cpuacct.usage
+    int      cur;       // memory.current or memory.usage_in_bytes
+    int      rec;       // memory.reclaim or memory.limit_in_bytes
+    uint64_t usage;     // cpu usage at the last tick; usec
+    uint64_t tick;      // ms of the last tick
+    uint64_t quiet;     // ms since it is quiet; 0 if busy
+    int      idle;      // idle for --idle-reclaim
+    int      done;      // nothing more to reclaim while idle
+    uint64_t spell;     // reclaimed while idle this time
+    uint64_t total;     // reclaimed since launch
+};
+typedef struct idle idle;
+
+
+// Open the files of 'cg'; do this before the kid is attached to it.
+// Returns 0 or -errno.
+extern int  idle_open(idle *d, cgroup *cg);
+
+// Call every IDLE_TICK_MS; 'ms' is --idle-reclaim.
+extern void idle_tick(idle *d, int ms);
+
+extern void idle_close(idle *d);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* ! ___IDLE_H__Nw8cQj3Ty6PgVm5D___ */
+
+/* EOF */
@@ -0,0 +1,157 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * image.c - rootfs images on loop devices.
+ *
+ * A read-only squashfs or erofs image is attached to a loop device
+ * with LOOP_CONFIGURE (Linux 5.8) in one step; the loop device does
+ * direct I/O to the image, so its blocks are cached once -- in the
+ * page cache of the file system mounted on it -- rather than twice.
+ * Older kernels take the LOOP_SET_FD + LOOP_SET_STATUS64 path.
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <linux/loop.h>
+
+#include "image.h"
+
+#define SQUASHFS_MAGIC      0x73717368  // "hsqs" at offset 0
+#define EROFS_MAGIC         0xe0f5e1e2  // at offset 1024
+
+// Attempts before we give up racing others for a free loop device
+#define LOOP_TRIES          8
+
+
+static uint32_t
+le32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+/*
+ * Identify the file system in the image by its magic.
+ */
+static const char *
+image_type(int fd)
+{
+    unsigned char b[1028];
+
+    if (pread(fd, b, sizeof b, 0) != (ssize_t)sizeof b) return 0;
+
+    if (le32(b)      == SQUASHFS_MAGIC) return "squashfs";
+    if (le32(b+1024) == EROFS_MAGIC)    return "erofs";
+    return 0;
+}
+
+
+/*
+ * Pre 5.8 kernels: attach, then set the flags.
+ */
+static int
+loop_legacy(int lfd, int ffd, const struct loop_info64 *info)
+{
+    struct loop_info64 li = *info;
+
+    if (ioctl(lfd, LOOP_SET_FD, ffd) < 0) return -errno;
+
+    li.lo_flags &= ~(LO_FLAGS_DIRECT_IO|LO_FLAGS_READ_ONLY);
+    if (ioctl(lfd, LOOP_SET_STATUS64, &li) < 0) {
+        int r = -errno;
+
+        ioctl(lfd, LOOP_CLR_FD, 0);
+        return r;
+    }
+
+    // Buffered I/O still works; it just caches the image twice.
+    ioctl(lfd, LOOP_SET_DIRECT_IO, 1UL);
+    return 0;
+}
+
+
+static int
+loop_configure(int lfd, int ffd, const char *path)
+{
+    struct loop_config lc;
+
+    memset(&lc, 0, sizeof lc);
+    lc.fd             = ffd;
+    lc.info.lo_flags  = LO_FLAGS_READ_ONLY | LO_FLAGS_AUTOCLEAR | LO_FLAGS_DIRECT_IO;
+    snprintf((char *)lc.info.lo_file_name, sizeof lc.info.lo_file_name, "%s", path);
+
+    if (ioctl(lfd, LOOP_CONFIGURE, &lc) == 0) return 0;
+    if (errno != EINVAL) return -errno;
+
+    // The backing file system may not do direct I/O.
+    lc.info.lo_flags &= ~LO_FLAGS_DIRECT_IO;
+    if (ioctl(lfd, LOOP_CONFIGURE, &lc) == 0) return 0;
+    if (errno != EINVAL) return -errno;
+
+    return loop_legacy(lfd, ffd, &lc.info);
+}
+
+
+int
+image_attach(const char *path, char *dev, size_t n, const char **fstype)
+{
+    int ffd, ctl, lfd = -1;
+    int r, i;
+
+    if ((ffd = open(path, O_RDONLY|O_CLOEXEC)) < 0) return -errno;
+
+    if (!(*fstype = image_type(ffd))) {
+        close(ffd);
+        return -EMEDIUMTYPE;
+    }
+
+    if ((ctl = open("/dev/loop-control", O_RDWR|O_CLOEXEC)) < 0) {
+        r = -errno;
+        close(ffd);
+        return r;
+    }
+
+    /*
+     * Someone else can grab the free device before we configure
+     * it; then it is busy and we try the next one.
+     */
+    for (r = -EBUSY, i = 0; r == -EBUSY && i < LOOP_TRIES; i++) {
+        int nr = ioctl(ctl, LOOP_CTL_GET_FREE);
+        if (nr < 0) {
+            r = -errno;
+            break;
+        }
+
+        snprintf(dev, n, "/dev/loop%d", nr);
+        if ((lfd = open(dev, O_RDONLY|O_CLOEXEC)) < 0) {
+            r = -errno;
+            break;
+        }
+
+        if ((r = loop_configure(lfd, ffd, path)) < 0) {
+            close(lfd);
+            lfd = -1;
+        }
+    }
+
+    // The loop device holds its own reference to the image.
+    close(ctl);
+    close(ffd);
+    return r < 0 ? r : lfd;
+}
+
+/* EOF */
@@ -0,0 +1,44 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * image.h - rootfs images on loop devices.
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+
+#ifndef ___IMAGE_H__Qv7cN2xLr9TbKe4W___
+#define ___IMAGE_H__Qv7cN2xLr9TbKe4W___ 1
+
+    /* Provide C linkage for symbols declared here .. */
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <stddef.h>
+
+/*
+ * Attach the squashfs or erofs image in file 'path' read-only to a
+ * free loop device; its path is returned in 'dev' and the file
+ * system type in 'fstype'. The loop device goes away once it is
+ * unmounted and the returned fd is closed.
+ *
+ * Returns an fd for the loop device or -errno (-EMEDIUMTYPE if the
+ * file isn't a squashfs or erofs image).
+ */
+extern int image_attach(const char *path, char *dev, size_t n, const char **fstype);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* ! ___IMAGE_H__Qv7cN2xLr9TbKe4W___ */
+
+/* EOF */
@@ -81,7 +81,7 @@ fi
 
 
 [ -f $pre  ] || cp ../examples/pre.sh  $pre  || die "can't cp pre.sh"
-[ -f $post ] || cp ../examples/post.sh $post || die "can't cp init.sh"
+[ -f $post ] || cp ../examples/init.sh $post || die "can't cp init.sh"
 
 cat <<EOF
 $Z: You can now create a unprivileged container via:
@@ -0,0 +1,178 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * mountfd.c - mounts as file descriptors (the new mount API).
+ *
+ * Thin wrappers over open_tree(2), move_mount(2), fsopen(2),
+ * fsconfig(2), fsmount(2) (Linux 5.2) and mount_setattr(2) (Linux
+ * 5.12); libc wrappers aren't available everywhere.
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/mount.h>
+#include <sys/syscall.h>
+
+#include "mountfd.h"
+
+#ifndef SYS_open_tree
+#define SYS_open_tree           428
+#endif
+#ifndef SYS_move_mount
+#define SYS_move_mount          429
+#endif
+#ifndef SYS_mount_setattr
+#define SYS_mount_setattr       442
+#endif
+#ifndef SYS_fsopen
+#define SYS_fsopen              430
+#endif
+#ifndef SYS_fsconfig
+#define SYS_fsconfig            431
+#endif
+#ifndef SYS_fsmount
+#define SYS_fsmount             432
+#endif
+
+#ifndef OPEN_TREE_CLONE
+#define OPEN_TREE_CLONE         1
+#endif
+#ifndef OPEN_TREE_CLOEXEC
+#define OPEN_TREE_CLOEXEC       O_CLOEXEC
+#endif
+#ifndef AT_RECURSIVE
+#define AT_RECURSIVE            0x8000
+#endif
+#ifndef MOVE_MOUNT_F_EMPTY_PATH
+#define MOVE_MOUNT_F_EMPTY_PATH 0x00000004
+#endif
+#ifndef FSOPEN_CLOEXEC
+#define FSOPEN_CLOEXEC          0x00000001
+#endif
+#ifndef FSMOUNT_CLOEXEC
+#define FSMOUNT_CLOEXEC         0x00000001
+#endif
+#ifndef FSCONFIG_SET_FLAG
+#define FSCONFIG_SET_FLAG       0
+#endif
+#ifndef FSCONFIG_SET_STRING
+#define FSCONFIG_SET_STRING     1
+#endif
+#ifndef FSCONFIG_CMD_CREATE
+#define FSCONFIG_CMD_CREATE     6
+#endif
+
+#ifndef MOUNT_ATTR_IDMAP
+#define MOUNT_ATTR_IDMAP        0x00100000
+
+struct mount_attr
+{
+    uint64_t attr_set;
+    uint64_t attr_clr;
+    uint64_t propagation;
+    uint64_t userns_fd;
+};
+#endif
+
+
+int
+mountfd_idmap(const char *path, int usernsfd)
+{
+    int mfd = syscall(SYS_open_tree, AT_FDCWD, path, OPEN_TREE_CLONE|OPEN_TREE_CLOEXEC|AT_RECURSIVE);
+    if (mfd < 0) return -errno;
+
+    struct mount_attr ma = {
+        .attr_set  = MOUNT_ATTR_IDMAP,
+        .userns_fd = usernsfd,
+    };
+
+    if (syscall(SYS_mount_setattr, mfd, "", AT_EMPTY_PATH|AT_RECURSIVE, &ma, sizeof ma) < 0) {
+        int r = -errno;
+
+        close(mfd);
+        return r;
+    }
+    return mfd;
+}
+
+
+int
+mountfd_clone(const char *path)
+{
+    int mfd = syscall(SYS_open_tree, AT_FDCWD, path, OPEN_TREE_CLONE|OPEN_TREE_CLOEXEC|AT_RECURSIVE);
+
+    return mfd < 0 ? -errno : mfd;
+}
+
+
+static int
+fs_config(int fsfd, const char *opt)
+{
+    char key[64];
+    const char *val = strchr(opt, '=');
+    int r;
+
+    if (!val) {
+        r = syscall(SYS_fsconfig, fsfd, FSCONFIG_SET_FLAG, opt, 0, 0);
+    } else {
+        if ((size_t)(val - opt) >= sizeof key) return -EINVAL;
+
+        snprintf(key, sizeof key, "%.*s", (int)(val - opt), opt);
+        r = syscall(SYS_fsconfig, fsfd, FSCONFIG_SET_STRING, key, val+1, 0);
+    }
+    return r < 0 ? -errno : 0;
+}
+
+
+int
+mountfd_new(const char *type, const char *source, const char *const *opts, unsigned attrs)
+{
+    int fsfd = syscall(SYS_fsopen, type, FSOPEN_CLOEXEC);
+    int mfd  = -1, r = 0;
+
+    if (fsfd < 0) return -errno;
+
+    if (source && syscall(SYS_fsconfig, fsfd, FSCONFIG_SET_STRING, "source", source, 0) < 0) {
+        r = -errno;
+        goto out;
+    }
+
+    for (; opts && *opts; opts++) {
+        if ((r = fs_config(fsfd, *opts)) < 0) goto out;
+    }
+
+    if (syscall(SYS_fsconfig, fsfd, FSCONFIG_CMD_CREATE, 0, 0, 0) < 0) {
+        r = -errno;
+        goto out;
+    }
+
+    if ((mfd = syscall(SYS_fsmount, fsfd, FSMOUNT_CLOEXEC, attrs)) < 0) r = -errno;
+
+out:
+    close(fsfd);
+    return r < 0 ? r : mfd;
+}
+
+
+int
+mountfd_attach(int mfd, int dfd, const char *path)
+{
+    if (syscall(SYS_move_mount, mfd, "", dfd, path, MOVE_MOUNT_F_EMPTY_PATH) < 0) return -errno;
+    return 0;
+}
+
+/* EOF */
@@ -0,0 +1,57 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * mountfd.h - mounts as file descriptors (the new mount API).
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+
+#ifndef ___MOUNTFD_H__Wm5sK8qRz3NdYc7J___
+#define ___MOUNTFD_H__Wm5sK8qRz3NdYc7J___ 1
+
+    /* Provide C linkage for symbols declared here .. */
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/*
+ * A detached mount is an fd: it can be made in one process, passed
+ * to another (e.g., over a unix socket) and attached there with
+ * mountfd_attach(). All functions return -errno on failure.
+ */
+
+// Clone the mount tree at 'path' and make it idmapped to the user
+// namespace 'usernsfd' (Linux 5.12): files owned by id N on disk
+// appear owned by whatever N maps to in that namespace. Needs
+// CAP_SYS_ADMIN in the file system's user namespace. Returns the
+// detached mount.
+extern int mountfd_idmap(const char *path, int usernsfd);
+
+// Clone the mount tree at 'path' (a recursive bind mount that
+// isn't attached anywhere yet). Returns the detached mount.
+extern int mountfd_clone(const char *path);
+
+// Make a new file system of 'type' from 'source' (may be null) and
+// the null terminated list of options 'opts' ("key=value" or
+// "flag") and mount it with the MOUNT_ATTR_* flags in 'attrs'.
+// Returns the detached mount.
+extern int mountfd_new(const char *type, const char *source, const char *const *opts, unsigned attrs);
+
+// Attach the detached mount 'mfd' on 'path' (relative to 'dfd')
+extern int mountfd_attach(int mfd, int dfd, const char *path);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* ! ___MOUNTFD_H__Wm5sK8qRz3NdYc7J___ */
+
+/* EOF */
@@ -0,0 +1,318 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * netlink.c - minimal rtnetlink helpers to plumb a veth pair.
+ *
+ * This replaces the handful of 'ip' invocations that a typical
+ * pre-exec script does; see examples/pre.sh.
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+#include <linux/veth.h>
+
+#include "netlink.h"
+
+#define NLBUFSIZE   1024
+
+struct nlreq
+{
+    struct nlmsghdr nh;
+    char            buf[NLBUFSIZE];
+};
+typedef struct nlreq nlreq;
+
+static unsigned Seq = 0;
+
+
+/*
+ * Append attribute 'type' to request 'r'. The attribute is found
+ * from the start of 'r' (not its header); so the compiler knows it
+ * is within the buffer.
+ */
+static struct rtattr *
+addattr(nlreq *r, int type, const void *data, size_t len)
+{
+    struct rtattr *a = (struct rtattr *)((char *)r + NLMSG_ALIGN(r->nh.nlmsg_len));
+    size_t alen      = RTA_LENGTH(len);
+
+    if ((NLMSG_ALIGN(r->nh.nlmsg_len) + RTA_ALIGN(alen)) > sizeof(nlreq)) return 0;
+
+    a->rta_type = type;
+    a->rta_len  = alen;
+    if (len > 0) memcpy(RTA_DATA(a), data, len);
+
+    r->nh.nlmsg_len = NLMSG_ALIGN(r->nh.nlmsg_len) + RTA_ALIGN(alen);
+    return a;
+}
+
+static inline void
+addattr_str(nlreq *r, int type, const char *s)
+{
+    addattr(r, type, s, strlen(s)+1);
+}
+
+// Close a nested attribute started by addattr(r, type, 0, 0)
+static inline void
+nest_end(nlreq *r, struct rtattr *nest)
+{
+    nest->rta_len = ((char *)r + r->nh.nlmsg_len) - (char *)nest;
+}
+
+
+/*
+ * Initialize a request of 'type' with a fixed header of 'hdrlen'
+ * bytes; returns pointer to the fixed header.
+ */
+static void *
+nl_init(nlreq *r, int type, int flags, size_t hdrlen)
+{
+    memset(r, 0, sizeof *r);
+    r->nh.nlmsg_len   = NLMSG_LENGTH(hdrlen);
+    r->nh.nlmsg_type  = type;
+    r->nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+    r->nh.nlmsg_seq   = ++Seq;
+    return NLMSG_DATA(&r->nh);
+}
+
+
+/*
+ * Send request 'r' and wait for its ack. If 'ifi' is non-null, it
+ * is filled with the ifinfomsg of a RTM_NEWLINK reply.
+ */
+static int
+nl_talk(int nl, nlreq *r, struct ifinfomsg *ifi)
+{
+    char buf[8192];
+    struct sockaddr_nl sa = { .nl_family = AF_NETLINK };
+
+    if (sendto(nl, r, r->nh.nlmsg_len, 0, (struct sockaddr *)&sa, sizeof sa) < 0) return -errno;
+
+    for (;;) {
+        ssize_t n = recv(nl, buf, sizeof buf, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -errno;
+        }
+
+        struct nlmsghdr *h = (struct nlmsghdr *)buf;
+        for (; NLMSG_OK(h, n); h = NLMSG_NEXT(h, n)) {
+            if (h->nlmsg_seq != r->nh.nlmsg_seq) continue;
+
+            if (h->nlmsg_type == NLMSG_ERROR) {
+                struct nlmsgerr *e = NLMSG_DATA(h);
+                return e->error;    // 0 is the ack
+            }
+
+            if (h->nlmsg_type == RTM_NEWLINK && ifi)
+                memcpy(ifi, NLMSG_DATA(h), sizeof *ifi);
+        }
+    }
+}
+
+
+int
+nl_open(void)
+{
+    struct sockaddr_nl sa = { .nl_family = AF_NETLINK };
+    int fd = socket(AF_NETLINK, SOCK_RAW|SOCK_CLOEXEC, NETLINK_ROUTE);
+
+    if (fd < 0) return -errno;
+    if (bind(fd, (struct sockaddr *)&sa, sizeof sa) < 0) {
+        int r = -errno;
+        close(fd);
+        return r;
+    }
+    return fd;
+}
+
+
+/*
+ * A netlink socket stays bound to the namespace it was created
+ * in. So, briefly step into the netns of 'pid' to create it.
+ */
+int
+nl_open_pid(pid_t pid)
+{
+    char path[PATH_MAX];
+    int self, kid, fd, r;
+
+    snprintf(path, sizeof path, "/proc/%d/ns/net", pid);
+
+    if ((self = open("/proc/self/ns/net", O_RDONLY|O_CLOEXEC)) < 0) return -errno;
+    if ((kid  = open(path, O_RDONLY|O_CLOEXEC)) < 0) {
+        r = -errno;
+        close(self);
+        return r;
+    }
+
+    if (setns(kid, CLONE_NEWNET) < 0) {
+        r = -errno;
+        goto done;
+    }
+
+    fd = nl_open();
+    if (setns(self, CLONE_NEWNET) < 0) {
+        // We can't continue in the wrong netns.
+        r = -errno;
+        if (fd >= 0) close(fd);
+        goto done;
+    }
+    r = fd;
+
+done:
+    close(kid);
+    close(self);
+    return r;
+}
+
+
+int
+nl_ifindex(int nl, const char *name)
+{
+    struct ifinfomsg ifi;
+    nlreq r;
+
+    struct ifinfomsg *m = nl_init(&r, RTM_GETLINK, 0, sizeof *m);
+    m->ifi_family = AF_UNSPEC;
+    addattr_str(&r, IFLA_IFNAME, name);
+
+    memset(&ifi, 0, sizeof ifi);
+    int e = nl_talk(nl, &r, &ifi);
+    if (e < 0) return e;
+
+    return ifi.ifi_index > 0 ? ifi.ifi_index : -ENODEV;
+}
+
+
+/*
+ * Create a veth pair; the peer is moved to the netns identified by
+ * attribute 'nstype' (IFLA_NET_NS_PID or IFLA_NET_NS_FD).
+ */
+static int
+veth_create(int nl, const char *host, const char *peer, int nstype, uint32_t ns)
+{
+    nlreq r;
+
+    struct ifinfomsg *m = nl_init(&r, RTM_NEWLINK, NLM_F_CREATE|NLM_F_EXCL, sizeof *m);
+    m->ifi_family = AF_UNSPEC;
+    addattr_str(&r, IFLA_IFNAME, host);
+
+    struct rtattr *li = addattr(&r, IFLA_LINKINFO, 0, 0);
+    addattr_str(&r, IFLA_INFO_KIND, "veth");
+
+    // The peer is an ifinfomsg followed by its own attributes
+    struct ifinfomsg pm = { .ifi_family = AF_UNSPEC };
+    struct rtattr *data = addattr(&r, IFLA_INFO_DATA, 0, 0);
+    struct rtattr *pi   = addattr(&r, VETH_INFO_PEER, &pm, sizeof pm);
+
+    addattr_str(&r, IFLA_IFNAME, peer);
+    addattr(&r, nstype, &ns, sizeof ns);
+
+    nest_end(&r, pi);
+    nest_end(&r, data);
+    nest_end(&r, li);
+
+    return nl_talk(nl, &r, 0);
+}
+
+
+int
+nl_veth_create(int nl, const char *host, const char *peer, pid_t pid)
+{
+    return veth_create(nl, host, peer, IFLA_NET_NS_PID, pid);
+}
+
+
+int
+nl_veth_create_fd(int nl, const char *host, const char *peer, int nsfd)
+{
+    return veth_create(nl, host, peer, IFLA_NET_NS_FD, nsfd);
+}
+
+
+int
+nl_link_rename(int nl, int ifindex, const char *name)
+{
+    nlreq r;
+
+    struct ifinfomsg *m = nl_init(&r, RTM_NEWLINK, 0, sizeof *m);
+    m->ifi_family = AF_UNSPEC;
+    m->ifi_index  = ifindex;
+    addattr_str(&r, IFLA_IFNAME, name);
+
+    return nl_talk(nl, &r, 0);
+}
+
+
+int
+nl_link_up(int nl, int ifindex)
+{
+    nlreq r;
+
+    struct ifinfomsg *m = nl_init(&r, RTM_NEWLINK, 0, sizeof *m);
+    m->ifi_family = AF_UNSPEC;
+    m->ifi_index  = ifindex;
+    m->ifi_flags  = IFF_UP;
+    m->ifi_change = IFF_UP;
+
+    return nl_talk(nl, &r, 0);
+}
+
+
+int
+nl_addr_add(int nl, int ifindex, struct in_addr addr, int prefix)
+{
+    nlreq r;
+
+    struct ifaddrmsg *m = nl_init(&r, RTM_NEWADDR, NLM_F_CREATE|NLM_F_EXCL, sizeof *m);
+    m->ifa_family    = AF_INET;
+    m->ifa_prefixlen = prefix;
+    m->ifa_scope     = RT_SCOPE_UNIVERSE;
+    m->ifa_index     = ifindex;
+
+    addattr(&r, IFA_LOCAL,   &addr, sizeof addr);
+    addattr(&r, IFA_ADDRESS, &addr, sizeof addr);
+
+    return nl_talk(nl, &r, 0);
+}
+
+
+int
+nl_route_default(int nl, struct in_addr gw)
+{
+    nlreq r;
+
+    struct rtmsg *m = nl_init(&r, RTM_NEWROUTE, NLM_F_CREATE|NLM_F_EXCL, sizeof *m);
+    m->rtm_family   = AF_INET;
+    m->rtm_table    = RT_TABLE_MAIN;
+    m->rtm_protocol = RTPROT_BOOT;
+    m->rtm_scope    = RT_SCOPE_UNIVERSE;
+    m->rtm_type     = RTN_UNICAST;
+
+    addattr(&r, RTA_GATEWAY, &gw, sizeof gw);
+
+    return nl_talk(nl, &r, 0);
+}
+
+/* EOF */
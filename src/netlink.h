@@ -0,0 +1,68 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * netlink.h - minimal rtnetlink helpers to plumb a veth pair.
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+
+#ifndef ___NETLINK_H__b7RkL2xWq9ZcN4Tf___
+#define ___NETLINK_H__b7RkL2xWq9ZcN4Tf___ 1
+
+    /* Provide C linkage for symbols declared here .. */
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <sys/types.h>
+#include <netinet/in.h>
+
+/*
+ * All functions below return 0 on success and -errno on failure.
+ * 'nl' is a NETLINK_ROUTE socket; it operates on the network
+ * namespace it was created in.
+ */
+
+// Open a rtnetlink socket in the current network namespace
+extern int nl_open(void);
+
+// Open a rtnetlink socket in the network namespace of 'pid'
+extern int nl_open_pid(pid_t pid);
+
+// Return the ifindex of link 'name' (> 0) or -errno
+extern int nl_ifindex(int nl, const char *name);
+
+// Create a veth pair 'host' <-> 'peer' and move 'peer' into the
+// network namespace of 'pid'
+extern int nl_veth_create(int nl, const char *host, const char *peer, pid_t pid);
+
+// Same as above; but the netns is given by an open nsfs fd
+extern int nl_veth_create_fd(int nl, const char *host, const char *peer, int nsfd);
+
+// Rename link 'ifindex' to 'name'; the link must be down.
+extern int nl_link_rename(int nl, int ifindex, const char *name);
+
+// Bring link 'ifindex' up
+extern int nl_link_up(int nl, int ifindex);
+
+// Add IPv4 address 'addr/prefix' to link 'ifindex'
+extern int nl_addr_add(int nl, int ifindex, struct in_addr addr, int prefix);
+
+// Add an IPv4 default route via 'gw'
+extern int nl_route_default(int nl, struct in_addr gw);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* ! ___NETLINK_H__b7RkL2xWq9ZcN4Tf___ */
+
+/* EOF */
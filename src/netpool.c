@@ -0,0 +1,253 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * netpool.c - pool of pre-created network namespaces.
+ *
+ * Creating a netns and its veth pair is the slowest part of a
+ * --network launch. The pool moves that off the launch path: a
+ * launch claims a ready netns and setns()'s into it before clone().
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/wait.h>
+#include <sys/mount.h>
+
+#include "error.h"
+#include "netlink.h"
+#include "netpool.h"
+
+extern int mkdirhier(const char *dir, mode_t mode);
+
+static const char Free[] = ".free";
+
+
+/*
+ * Return true if 'nm' is a free marker; and put the entry name
+ * in 'name'.
+ */
+static int
+is_free(const char *nm, char *name, size_t n)
+{
+    size_t len = strlen(nm);
+    size_t sfx = sizeof Free - 1;
+
+    if (len <= sfx || len - sfx >= n)       return 0;
+    if (0 != strcmp(nm + len - sfx, Free))  return 0;
+
+    memcpy(name, nm, len - sfx);
+    name[len - sfx] = 0;
+    return 1;
+}
+
+
+static int
+count_free(const char *dir)
+{
+    char name[NAME_MAX+1];
+    struct dirent *de;
+    DIR *d = opendir(dir);
+    int n  = 0;
+
+    if (!d) error(1, errno, "can't open netns pool %s", dir);
+
+    while ((de = readdir(d))) {
+        if (is_free(de->d_name, name, sizeof name)) n++;
+    }
+    closedir(d);
+    return n;
+}
+
+
+/*
+ * Create one pool entry 'name' in 'dir'.
+ */
+static void
+netpool_add(const char *dir, const char *name)
+{
+    char path[PATH_MAX];
+    char src[64];
+    int self, nsfd, nl, idx, fd, r;
+
+    snprintf(path, sizeof path, "%s/%s", dir, name);
+
+    if ((self = open("/proc/self/ns/net", O_RDONLY|O_CLOEXEC)) < 0)
+        error(1, errno, "can't open my netns");
+
+    if (unshare(CLONE_NEWNET) < 0) error(1, errno, "can't create netns");
+    if ((nsfd = open("/proc/self/ns/net", O_RDONLY|O_CLOEXEC)) < 0)
+        error(1, errno, "can't open new netns");
+
+    // While we are here, bring up 'lo'.
+    if ((nl = nl_open()) < 0) error(1, -nl, "can't open netlink socket");
+    if ((idx = nl_ifindex(nl, "lo")) < 0) error(1, -idx, "can't find lo");
+    if ((r = nl_link_up(nl, idx)) < 0) error(1, -r, "can't bring up lo");
+    close(nl);
+
+    if (setns(self, CLONE_NEWNET) < 0) error(1, errno, "can't return to my netns");
+    close(self);
+
+    // Pin the netns by bind mounting it
+    if ((fd = open(path, O_RDONLY|O_CREAT|O_EXCL|O_CLOEXEC, 0400)) < 0)
+        error(1, errno, "can't create %s", path);
+    close(fd);
+
+    snprintf(src, sizeof src, "/proc/self/fd/%d", nsfd);
+    if (mount(src, path, "none", MS_BIND, 0) < 0) error(1, errno, "can't bind mount netns to %s", path);
+
+    if ((nl = nl_open()) < 0) error(1, -nl, "can't open netlink socket");
+    r = nl_veth_create_fd(nl, name, NETPOOL_PEER, nsfd);
+    if (r < 0) error(1, -r, "can't create veth pair %s:%s", name, NETPOOL_PEER);
+    close(nl);
+    close(nsfd);
+
+    // Finally, mark it free
+    snprintf(path, sizeof path, "%s/%s%s", dir, name, Free);
+    if ((fd = open(path, O_RDONLY|O_CREAT|O_EXCL|O_CLOEXEC, 0400)) < 0)
+        error(1, errno, "can't create %s", path);
+    close(fd);
+}
+
+
+/*
+ * Remove entry 'name' from 'dir'; the netns lives on for as long
+ * as someone holds an fd to it.
+ */
+static void
+netpool_del(const char *dir, const char *name)
+{
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof path, "%s/%s", dir, name);
+    umount2(path, MNT_DETACH);
+    unlink(path);
+}
+
+
+int
+netpool_take(const char *dir, char *name, size_t n)
+{
+    char path[PATH_MAX];
+    struct dirent *de;
+    int fd = -1;
+    DIR *d = opendir(dir);
+
+    if (!d) return -1;
+
+    while ((de = readdir(d))) {
+        if (!is_free(de->d_name, name, n)) continue;
+
+        // Unlinking the marker is the claim; only one of us wins.
+        snprintf(path, sizeof path, "%s/%s", dir, de->d_name);
+        if (unlink(path) < 0) continue;
+
+        snprintf(path, sizeof path, "%s/%s", dir, name);
+        fd = open(path, O_RDONLY|O_CLOEXEC);
+        netpool_del(dir, name);
+        if (fd >= 0) break;
+    }
+    closedir(d);
+    return fd;
+}
+
+
+void
+netpool_fill(const char *dir, int n)
+{
+    char path[PATH_MAX];
+    char name[NAME_MAX+1];
+    int lk, r, k;
+
+    r = mkdirhier(dir, 0700);
+    if (r < 0 && r != -EEXIST) error(1, -r, "can't mkdir %s", dir);
+
+    // Serialize concurrent fills
+    snprintf(path, sizeof path, "%s/.lock", dir);
+    if ((lk = open(path, O_RDWR|O_CREAT|O_CLOEXEC, 0600)) < 0) error(1, errno, "can't open %s", path);
+    if (flock(lk, LOCK_EX) < 0) error(1, errno, "can't lock %s", path);
+
+    snprintf(path, sizeof path, "%s/.size", dir);
+    FILE *fp = fopen(path, "w");
+    if (!fp) error(1, errno, "can't create %s", path);
+    fprintf(fp, "%d\n", n);
+    fclose(fp);
+
+    if (n == 0) {
+        int fd;
+
+        while ((fd = netpool_take(dir, name, sizeof name)) >= 0) close(fd);
+    } else {
+        for (k = 0, r = count_free(dir); r < n; r++, k++) {
+            // The host end of the veth pair has the same name; so
+            // keep it within IFNAMSIZ.
+            snprintf(name, sizeof name, "nsp%d.%d", getpid(), k);
+            netpool_add(dir, name);
+        }
+    }
+
+    close(lk);
+}
+
+
+void
+netpool_refill(const char *dir)
+{
+    char path[PATH_MAX];
+    int n = 0;
+
+    snprintf(path, sizeof path, "%s/.size", dir);
+    FILE *fp = fopen(path, "r");
+    if (!fp) return;
+    if (1 != fscanf(fp, "%d", &n)) n = 0;
+    fclose(fp);
+
+    if (n <= 0 || count_free(dir) >= n) return;
+
+    // Double fork so that the caller doesn't have to reap us and
+    // we don't hold on to the caller's stdio.
+    pid_t p = fork();
+    if (p < 0) {
+        error(0, errno, "can't fork to refill netns pool");
+        return;
+    }
+
+    if (p > 0) {
+        waitpid(p, 0, 0);
+        return;
+    }
+
+    if (fork() != 0) _exit(0);
+
+    setsid();
+    int fd = open("/dev/null", O_RDWR);
+    if (fd >= 0) {
+        dup2(fd, 0);
+        dup2(fd, 1);
+        dup2(fd, 2);
+        if (fd > 2) close(fd);
+    }
+
+    netpool_fill(dir, n);
+    _exit(0);
+}
+
+/* EOF */
@@ -0,0 +1,56 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * netpool.h - pool of pre-created network namespaces.
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+
+#ifndef ___NETPOOL_H__Hc5yP1sVd8MwK3Ja___
+#define ___NETPOOL_H__Hc5yP1sVd8MwK3Ja___ 1
+
+    /* Provide C linkage for symbols declared here .. */
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <stddef.h>
+
+/*
+ * Each pool entry is a network namespace bind-mounted at DIR/NAME;
+ * it has 'lo' up and a veth pair: NAME in the host netns and
+ * NETPOOL_PEER inside the pooled netns. Both links are down and
+ * unconfigured. A free entry has a marker file DIR/NAME.free;
+ * whoever unlinks the marker owns the entry.
+ */
+
+#define NETPOOL_DIR     "/run/ns/netns"
+#define NETPOOL_PEER    "eth0"
+
+// Top up the pool in 'dir' to 'n' free entries and remember 'n'
+// as the pool size. n == 0 drains the pool.
+extern void netpool_fill(const char *dir, int n);
+
+// Claim a free entry; returns an open nsfs fd and the entry name
+// (i.e., the host end of the veth pair) in 'name'. The entry is
+// removed from 'dir'. Returns -1 if the pool is empty.
+extern int  netpool_take(const char *dir, char *name, size_t namesize);
+
+// Top up the pool in the background to its remembered size.
+extern void netpool_refill(const char *dir);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* ! ___NETPOOL_H__Hc5yP1sVd8MwK3Ja___ */
+
+/* EOF */
@@ -31,29 +31,133 @@
 #include <sys/wait.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <sys/syscall.h>
+#include <sys/prctl.h>
+#include <sys/sysmacros.h>
 #include <sched.h>
+#include <spawn.h>
+#include <poll.h>
+#include <linux/sched.h>
+#include <net/if.h>
+#include <arpa/inet.h>
 
 #include "getopt_long.h"
 #include "error.h"
+#include "trace.h"
+#include "netlink.h"
+#include "netpool.h"
+#include "place.h"
+#include "pidfd.h"
+#include "image.h"
+#include "prefetch.h"
+#include "mountfd.h"
+#include "hook.h"
+#include "stats.h"
+#include "adapt.h"
+#include "arbiter.h"
+#include "idle.h"
+#include "oom.h"
+#include "ns.h"
 
+/*
+ * The kid learns its rootfs and init from the parent when it is
+ * released; so the same parked kid can be used for any container.
+ */
 struct container_config {
-    char * const rootfs;     // root of the namespaced file-system
-    char * const init;       // pid-0
+    char *rootfs;     // root of the namespaced file-system
+    char *init;       // pid-0
+    char *upper;      // overlay upper/work parent; "" if none
 
+    int  mntfd; // idmapped rootfs from the parent (--idmap)
     int  fd;    // socketpair fd for communicating with parent
+    int  pfd;   // parent's end of the socketpair
 };
 typedef struct container_config container_config;
 
 
+/*
+ * What main() checked of a one-shot container; every start (and
+ * --restart) of it is done from this.
+ */
+struct launch_config {
+    char *pre;
+    char *rootfs;
+    char *init;
+    int   flags;    // clone(2) flags
+    int   uid, gid;
+
+    // Of the last restart; 0 before the first
+    int      restart;
+    uint64_t died;      // ms at the death before it
+    int      backoff;   // ms waited after that
+};
+typedef struct launch_config launch_config;
+
+
+// --io-max DEV,key=val,..; zero values are not set.
+struct io_limit {
+    unsigned maj, min;
+    uint64_t rbps, wbps;
+    uint64_t riops, wiops;
+};
+typedef struct io_limit io_limit;
+
+#define IOMAX_DEVS  8
+
+// How long 'ns freeze' waits for all processes to stop
+#define FREEZE_TIMEOUT_MS   5000
+
+// ioprio_set(2) constants; not all libcs have <linux/ioprio.h>
+#define IOPRIO_CLASS_SHIFT  13
+#define IOPRIO_WHO_PROCESS  1
+
+
 /*
  * Globals
  */
 uint64_t    Memlimit = 0;
+uint64_t    Adaptmin = 0;
+uint64_t    Adaptmax = 0;
+uint64_t    Membudget = 0;
+int         Idlereclaim = 0;
+int         Restarts = 0;
+uint64_t    Swaplimit = 0;
+int         Swapset  = 0;   // --swap was given
+uint64_t    Zswapmax = SWAP_UNLIMITED;
+int         Zswapset = 0;   // --zswap was given
+int         Zswapwb  = -1;  // --zswap-writeback; -1 if not given
+uint32_t    Cpus     = 0;
+const char *Cpuset   = 0;
+int         Cpuweight = 0;
+int         Ioweight = 0;
+int         Ioprio   = 0;
+int         Pretimeout = 0;
+const char *Lower    = 0;
+const char *Upper    = 0;
+const char *Image    = 0;
+int         Record   = 0;
+int         Prefetch = 0;
+int         Idmap    = 0;
+const char *Hook     = 0;
+int         Statsinterval = 0;
+const char *Statsto  = 0;
+static int  Legacymount = 0; // mount(2) instead of the fd mount API
+
+// The loop device --image is attached to; see attach_image()
+static char        Imagedev[32];
+static const char *Imagefs;
+
+static io_limit Iomax[IOMAX_DEVS];
+static int      Niomax = 0;
 int         Verbose  = 0;
 int         Netns    = 0;
 int         Userns   = 0;
 int         Unprivns = 0;
+const char *Tracefile = 0;
+veth_config *Veth    = 0;
+const char *Netpool  = 0;
+int         Zygotes  = 4;
 
 
 /*
@@ -70,27 +174,39 @@ extern const char *dirname(char *buf, size_t bsize, const char *path);
  */
 
 static uint64_t grok_size(const char *str, const char *optname);
+static uint64_t grok_swap(const char *str, const char *optname);
+static uint32_t grok_cpus(const char *str);
+static void     parse_iomax(io_limit *io, const char *str);
+static void     parse_adapt(const char *str);
+static char *   parse_share(char *buf, size_t n, const char *str);
+static int      parse_ioprio(const char *str);
 static int      parse_options(int argc, char *const argv[]);
-static int      parse_uidgid(const char *str);
-static void     validate_exe(const char *root, const char *exe);
 static int      child_func(void *arg);
+static void     child_config(container_config *cc);
 static int      switchroot(const char *root);
+static void     setup_root(container_config *cc);
+static int      setup_root_fd(container_config *cc);
+static void     mount_overlay(const container_config *cc);
 static int      maybe_mkdir(const char *dn, int mode);
 static void     update_setgroups(pid_t kid, char *str);
-static void     limit_memory(pid_t kid, uint64_t membytes);
-static void     run_exe(char *const exe, pid_t kid);
+static void     parse_veth(veth_config *v, const char *str);
+static void     setup_veth(pid_t kid, const veth_config *v, const char *pooled);
+static int      enter_netns(int nsfd);
 static void     writemap(const char *fmt, pid_t kid, int uid);
-static int      reap_child(pid_t kid, int opt);
-static int      check_unpriv_userns(int euid);
+static int      run(launch_config *lc, int *oomed);
+static int      freeze(const char *id, int on);
+static int      reap_child(pid_t kid, int pidfd, stats *s, adapt *a, idle *d, oom *o);
+static int      exit_code(int status);
 static char *   flags2str(char *, size_t, uint32_t  flags);
 static void     target_mount(char *const rootfs, const char *dir, const char *fs, unsigned long flags);
 //static void     make_devs(char *const rootfs, const device* dev);
 
-static void wait_socketio(int fd, const char*);
-static void signal_socketio(int fd, int eof, const char*);
+static size_t wait_socketio(int fd, void *buf, size_t n, const char*);
+static int    send_fd(int sock, int fd);
+static int    recv_fd(int sock);
 
 
-static void
+void
 progress(const char *fmt, ...)
 {
     if (!Verbose) return;
@@ -109,18 +225,39 @@ usage(char *msg)
     if (msg) warn(msg);
 
     printf("Usage: %s [options] pre-exec.sh /path/to/rootfs post-exec.sh [uid gid]\n"
+            "       %s [options] netpool N\n"
+            "       %s [options] daemon /path/to/socket [uid gid]\n"
+            "       %s launch /path/to/socket pre-exec.sh /path/to/rootfs post-exec.sh [share]\n"
+            "       %s stop /path/to/socket PID\n"
+            "       %s status /path/to/socket\n"
+            "       %s freeze ID\n"
+            "       %s thaw ID\n"
             "\n"
             "Where:\n"
             " pre-exec.sh     is called by the parent before creating the container. This can\n"
             "                 be used to setup a network namespace and 'veth' ethernet adapter.\n"
             "                 This should be accessible and executable by the parent.\n"
-            "                 This script is called with one argument: PID of the child\n"
+            "                 This script is called with one argument: PID of the child,\n"
+            "                 in /tmp. Use '-' to skip the pre-exec script.\n"
             " /path/to/rootfs is the path to a directory containing the root file system for\n"
             "                 the container. This directory will become the new 'root' in the\n"
             "                 mount-namespace.\n"
             " post-exec.sh    is called by the parent after the container namespace is setup. This\n"
             "                 script is expected to live inside '/path/to/rootfs' sub-directory.\n"
             "\n"
+            "The second form tops up the netns pool (see --netns-pool) to N ready network\n"
+            "namespaces; N = 0 drains the pool.\n"
+            "\n"
+            "The third form runs a daemon that launches and supervises containers; it keeps\n"
+            "--zygotes kids cloned and parked, ready to become a container. The remaining\n"
+            "forms ask that daemon to launch a container (and print its pid), to stop one\n"
+            "(SIGTERM, then SIGKILL after 5s) or to list the running containers. The\n"
+            "daemon's options apply to every container.\n"
+            "\n"
+            "The last two forms stop and resume all processes of container ID: the pid\n"
+            "printed by 'launch' (or the pid of a one-shot 'ns'). Only a container with a\n"
+            "cgroup (any resource option or --stats-interval) can be frozen.\n"
+            "\n"
             "If --user or -u option is specified, then the next two arguments are mandatory:\n"
             " uid             UID-0 inside the container is mapped to this 'uid'.\n"
             " gid             GID-0 inside the container is mapped to this 'gid'.\n"
@@ -131,9 +268,69 @@ usage(char *msg)
             "  --memory=M, -m M Limit container to M bytes of memory [256M]\n"
             "                   Optional suffixes of 'k', 'M', 'G' denote kilo, Mega and Gigabyte\n"
             "                   multiples.\n"
+            "  --memory-adapt=MIN:MAX, -a MIN:MAX Keep a soft limit (memory.high) between MIN\n"
+            "                 and MAX; raised on memory pressure, lowered while there is\n"
+            "                 none. Needs cgroup v2. --memory, if given, is the hard limit.\n"
+            "  --memory-budget=B, -G B Daemon: split B bytes between the containers by\n"
+            "                 the 'share' of each launch: prio=P,min=M,max=X (all optional;\n"
+            "                 P is 1-10000 [100]); memory.high/low on v2, the soft limit on v1\n"
+            "  --swap=S, -W S Let the container use S bytes of swap; S is a size, 'unlimited'\n"
+            "                 or 0 [0]. On cgroup v1 this needs --memory.\n"
+            "  --zswap=S, -Z S Limit the container's compressed swap cache (zswap) to S bytes;\n"
+            "                 'unlimited' or 0 (bypass zswap). Needs cgroup v2.\n"
+            "  --zswap-writeback=on|off, -k on|off With 'off' the container's pages stay in\n"
+            "                 zswap and are never written to the swap device. Needs cgroup v2.\n"
+            "  --idle-reclaim=T, -Q T Reclaim the memory of a container that used less\n"
+            "                 than 1%% of a cpu for T milliseconds [off]\n"
+            "  --restart=N, -r N Start a container again after it is OOM killed, up to N\n"
+            "                 times; the wait before each doubles from 100ms [0]\n"
+            "  --cpus=N, -c N Limit container to N cpus worth of cpu time (0.01-1000); e.g., 1.5\n"
+            "  --cpuset=L, -s L Pin container to the cpus in list L; e.g., 0-3,8\n"
+            "                 'auto' picks --cpus (or 1) least used cpus sharing a cache\n"
+            "                 and NUMA node.\n"
+            "  --cpu-weight=W, -w W Set container's cpu weight to W (1-10000) [100]\n"
+            "  --io-max=S, -b S Throttle container I/O to a block device; S = dev,key=val,..\n"
+            "                 dev is a device node or MAJ:MIN; keys are rbps, wbps, riops and\n"
+            "                 wiops; e.g., /dev/sda,rbps=10M,wiops=200. Can be repeated.\n"
+            "  --io-weight=W, -B W Set container's I/O weight to W (1-10000) [100]\n"
+            "                 v1 blkio.weight is W * 5 (10-1000); 100 is its default 500.\n"
+            "  --pre-timeout=S, -T S Kill the pre-exec script (and its process group) if it\n"
+            "                 runs for more than S seconds; the launch fails [no limit]\n"
+            "  --stats-interval=T, -S T Sample the container's cgroup (memory, cpu, I/O and\n"
+            "                 pressure) every T milliseconds as JSON lines [off]\n"
+            "  --stats-to=F, -O F Send the samples to file or unix socket F ('-' is\n"
+            "                 stdout) [-]\n"
+            "  --hook=F, -H F Load the shared object F and call its ns_pre_exec() before\n"
+            "                 the pre-exec script; the script runs only if it asks for it\n"
+            "  --io-prio=P, -p P Set the I/O priority of container init to P = class[:level]\n"
+            "                 class is rt, be or idle; level is 0 (highest) to 7 [4]\n"
+            "  --lower=L, -L L Mount an overlay of the dirs in L = dir[:dir..] (topmost first)\n"
+            "                 on /path/to/rootfs and use that as the root\n"
+            "  --upper=D, -U D Make the overlay writable; its upper and work dirs live in D\n"
+            "                 (D/PID per container in daemon mode) [read-only overlay]\n"
+            "  --image=F, -I F Mount the squashfs or erofs image in file F read-only on\n"
+            "                 /path/to/rootfs (via a loop device) and use that as the root\n"
+            "  --record-prefetch, -R Record the files init reads in its first 10s to a\n"
+            "                 manifest next to the rootfs (or image, or topmost --lower)\n"
+            "  --prefetch, -f Read ahead the ranges in that manifest while the pre-exec\n"
+            "                 script runs\n"
+            "  --legacy-mount, -M Set up the container's mounts with mount(2) path by path\n"
+            "                 instead of the fd based mount API (for comparison)\n"
             "  --network, -n  Setup network namespace as well\n"
+            "  --veth=S, -e S Setup network namespace and plumb a veth pair described by\n"
+            "                 S = host:cont,addr/prefix,gw; e.g., veth0:eth0,10.99.88.2/24,10.99.88.1\n"
+            "                 'host' is given address 'gw'; 'cont' is given 'addr' and a default\n"
+            "                 route via 'gw'.\n"
+            "  --netns-pool=D, -P D Take the network namespace from the pool in D instead of\n"
+            "                 creating one; the pool is refilled in the background.\n"
+            "                 [" NETPOOL_DIR "]\n"
+            "  --zygotes=N, -z N Keep N parked kids in daemon mode [4]\n"
             "  --user, -u     Setup user namespace as well (with default uid/gid mapping)\n"
-            "", program_name);
+            "  --idmap, -i    With --user, mount the rootfs idmapped: files owned by uid/gid\n"
+            "                 0 on disk are owned by root in the container; no chown needed\n"
+            "  --trace=F, -t F Write startup phase timestamps as JSON to file F ('-' is stdout)\n"
+            "", program_name, program_name, program_name, program_name, program_name, program_name,
+            program_name, program_name);
 
 }
 
@@ -199,33 +396,224 @@ maybe_mkdir(const char *dn, int mode)
 
 
 /*
- * Switch to new root 'root'
+ * Mount the --lower dirs (and the upper, if any) as an overlay on
+ * the rootfs; the kid's mount namespace is private, so nobody else
+ * sees it. Without an upper the overlay is read-only.
+ */
+static void
+mount_overlay(const container_config *cc)
+{
+    char opts[3 * PATH_MAX];
+    unsigned long flags = 0;
+    int n;
+
+    if (cc->upper[0])
+        n = snprintf(opts, sizeof opts, "lowerdir=%s,upperdir=%s/upper,workdir=%s/work",
+                     Lower, cc->upper, cc->upper);
+    else {
+        n = snprintf(opts, sizeof opts, "lowerdir=%s", Lower);
+        flags = MS_RDONLY;
+    }
+    if (n >= (int)sizeof opts) die("child: overlay dirs are too long");
+
+    if (mount("overlay", cc->rootfs, "overlay", flags, opts) < 0)
+        error(1, errno, "child: can't mount overlay on %s (%s)", cc->rootfs, opts);
+}
+
+
+/*
+ * A read-only root gets a tmpfs /tmp (if it has a /tmp).
+ */
+static int
+readonly_root(const container_config *cc)
+{
+    return Image || (Lower && !cc->upper[0]);
+}
+
+
+// True if 'dir' (relative to 'dfd') is a directory
+static int
+has_dir(int dfd, const char *dir)
+{
+    struct stat st;
+
+    return fstatat(dfd, dir, &st, 0) == 0 && S_ISDIR(st.st_mode);
+}
+
+
+/*
+ * Set up the kid's root path by path: mount each file system on
+ * its dir under the rootfs, bind mount the rootfs on itself and
+ * pivot into it. This is the fallback for kernels without the new
+ * mount API (and --legacy-mount).
+ */
+static void
+setup_root(container_config *cc)
+{
+    if (Image) {
+        progress("child: mounting %s (%s) on %s ..\n", Imagedev, Imagefs, cc->rootfs);
+        if (mount(Imagedev, cc->rootfs, Imagefs, MS_RDONLY, 0) < 0)
+            error(1, errno, "child: can't mount %s on %s", Imagedev, cc->rootfs);
+        trace_mark("image");
+    }
+
+    if (cc->mntfd >= 0) {
+        progress("child: attaching idmapped rootfs on %s ..\n", cc->rootfs);
+        int r = mountfd_attach(cc->mntfd, AT_FDCWD, cc->rootfs);
+        if (r < 0) error(1, -r, "child: can't attach idmapped rootfs on %s", cc->rootfs);
+
+        close(cc->mntfd);
+        trace_mark("attach");
+    }
+
+    if (Lower) {
+        progress("child: mounting overlay of %s on %s ..\n", Lower, cc->rootfs);
+        mount_overlay(cc);
+        trace_mark("overlay");
+    }
+
+    progress("child: mounting /proc ..\n");
+    target_mount(cc->rootfs, "/proc", "proc",  MS_NOEXEC|MS_NOSUID|MS_NODEV);
+    trace_mark("proc");
+
+    char tmp[PATH_MAX];
+
+    snprintf(tmp, sizeof tmp, "%s/tmp", cc->rootfs);
+    if (readonly_root(cc) && has_dir(AT_FDCWD, tmp)) {
+        if (mount("tmpfs", tmp, "tmpfs", MS_NOSUID|MS_NODEV, "mode=1777") < 0)
+            error(1, errno, "child: can't mount tmpfs on %s", tmp);
+    }
+
+    // Don't mount a new /dev; we can't make device nodes! The
+    // rootfs should come with a /dev.
+    //target_mount(cc->rootfs, "/dev",  "tmpfs", MS_NOEXEC|MS_NOSUID);
+
+    /*
+     * XXX Once we pivot, it appears that we lose the ability to mount
+     *     file systems. I don't understand why this restriction for
+     *     namespaced children.
+     */
+    switchroot(cc->rootfs);
+    trace_mark("pivot");
+}
+
+
+/*
+ * Mount the overlay of --lower as a detached mount.
+ */
+static int
+overlay_tree(const container_config *cc)
+{
+    char lower[PATH_MAX+16], upper[PATH_MAX+16], work[PATH_MAX+16];
+    const char *opts[4] = { lower, 0, 0, 0 };
+
+    snprintf(lower, sizeof lower, "lowerdir=%s", Lower);
+    if (!cc->upper[0]) {
+        opts[1] = "ro";
+        return mountfd_new("overlay", "overlay", opts, MOUNT_ATTR_RDONLY);
+    }
+
+    snprintf(upper, sizeof upper, "upperdir=%s/upper", cc->upper);
+    snprintf(work,  sizeof work,  "workdir=%s/work",   cc->upper);
+    opts[1] = upper;
+    opts[2] = work;
+    return mountfd_new("overlay", "overlay", opts, 0);
+}
+
+
+// Mount a new 'type' file system on 'dir' in the tree 'tree'
+static void
+tree_mount(int tree, const char *dir, const char *type, const char *opt, unsigned attrs)
+{
+    const char *opts[2] = { opt, 0 };
+    int mfd = mountfd_new(type, type, opts, attrs);
+    int r;
+
+    if (mfd < 0) error(1, -mfd, "child: can't make %s for /%s", type, dir);
+    if ((r = mountfd_attach(mfd, tree, dir)) < 0) error(1, -r, "child: can't mount %s on /%s", type, dir);
+    close(mfd);
+}
+
+
+/*
+ * Set up the kid's root with the new mount API: the root is built
+ * as one detached mount -- an idmapped or plain clone of the
+ * rootfs, the image or the overlay -- and attached once on the
+ * rootfs; proc (and tmpfs) go on top of it relative to its fd.
+ * There's no bind mount, no mkdir in the rootfs and no path is
+ * looked up twice. Returns -ENOSYS, having changed nothing, if the
+ * kernel doesn't have the new mount API.
+ */
+static int
+setup_root_fd(container_config *cc)
+{
+    int tree, r;
+
+    if (cc->mntfd >= 0)
+        tree = cc->mntfd;
+    else if (Image) {
+        const char *opts[] = { "ro", 0 };
+
+        tree = mountfd_new(Imagefs, Imagedev, opts, MOUNT_ATTR_RDONLY);
+    } else if (Lower)
+        tree = overlay_tree(cc);
+    else
+        tree = mountfd_clone(cc->rootfs);
+
+    if (tree == -ENOSYS) return tree;
+    if (tree < 0) error(1, -tree, "child: can't make the root mount for %s", cc->rootfs);
+
+    if ((r = mountfd_attach(tree, AT_FDCWD, cc->rootfs)) < 0)
+        error(1, -r, "child: can't attach the root mount on %s", cc->rootfs);
+    trace_mark("tree");
+
+    tree_mount(tree, "proc", "proc", 0, MOUNT_ATTR_NOEXEC|MOUNT_ATTR_NOSUID|MOUNT_ATTR_NODEV);
+    trace_mark("proc");
+
+    if (readonly_root(cc) && has_dir(tree, "tmp"))
+        tree_mount(tree, "tmp", "tmpfs", "mode=1777", MOUNT_ATTR_NOSUID|MOUNT_ATTR_NODEV);
+
+    if (fchdir(tree) < 0) error(1, errno, "child: can't chdir to the root mount");
+
+    r = syscall(SYS_pivot_root, ".", ".");
+    if (r < 0) error(1, errno, "child: can't pivot root to %s", cc->rootfs);
+
+    r = umount2(".", MNT_DETACH);
+    if (r < 0) error(1, errno, "child: can't umount old root");
+
+    chdir("/");
+    close(tree);
+    trace_mark("pivot");
+    return 0;
+}
+
+
+/*
+ * Switch to new root 'root'. pivot_root(".", ".") stacks the old
+ * root on top of the new one; so we need no put-old dir in the
+ * rootfs (which may be read-only) and can lazily unmount it right
+ * away.
  */
 static int
 switchroot(const char *root)
 {
     int r;
     char rootpath[PATH_MAX+1];
-    char pivot[PATH_MAX+1];
-
-    realpath(root, rootpath);
-    snprintf(pivot, PATH_MAX, "%s/tmp/.pivot", rootpath);
 
-    r = maybe_mkdir(pivot, 0700);
-    if (r < 0) error(1, errno, "can't mkdir %s", pivot);
+    if (!realpath(root, rootpath)) error(1, errno, "can't resolve %s", root);
 
     r = mount(rootpath, rootpath, "bind", MS_BIND|MS_REC, "");
     if (r < 0) error(1, errno, "can't bind mount %s", rootpath);
 
-    r = syscall(SYS_pivot_root, rootpath, pivot);
-    if (r < 0) error(1, errno, "can't pivot root to %s", pivot);
+    if (chdir(rootpath) < 0) error(1, errno, "can't chdir to %s", rootpath);
 
-    chdir("/");
+    r = syscall(SYS_pivot_root, ".", ".");
+    if (r < 0) error(1, errno, "can't pivot root to %s", rootpath);
 
-    r = umount2("/tmp/.pivot", MNT_DETACH);
-    if (r < 0) error(1, errno, "can't umount /.pivot");
+    r = umount2(".", MNT_DETACH);
+    if (r < 0) error(1, errno, "can't umount old root");
 
-    rmdir("/tmp/.pivot");
+    chdir("/");
     return 0;
 }
 
@@ -234,15 +622,42 @@ child_func(void *arg)
 {
     container_config *cc = arg;
 
+    trace_child();
+    trace_mark("child");
+
+    // A parked kid must not outlive its parent. And, init must not
+    // inherit signals blocked by a daemon parent.
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, 0);
+
     progress("child: uid %d, pid %d; waiting for parent to setup ..\n", getuid(), getpid());
 
+    // We must not hold the parent's end; else we never see EOF if
+    // the parent dies before releasing us.
+    close(cc->pfd);
+
     /*
      * Wait until the parent has updated the UID and GID mappings.
-     * See the comment in main(). We wait for end of file on a
-     * pipe that will be closed by the parent process once it has
-     * updated the mappings.
+     * See the comment in main(). The parent releases us by sending
+     * the rootfs and init to use; with --idmap that is preceded by
+     * the idmapped rootfs.
+     */
+    if (Idmap && (cc->mntfd = recv_fd(cc->fd)) < 0) die("child: no idmapped rootfs from parent");
+    child_config(cc);
+    prctl(PR_SET_PDEATHSIG, 0);
+    trace_mark("wakeup");
+
+    /*
+     * When the parent is root, our credentials are still those of
+     * the host root - which is not mapped in the new user namespace.
+     * Switch to the mapped uid/gid 0.
      */
-    wait_socketio(cc->fd, "child");
+    if (Userns) {
+        if (setresgid(0, 0, 0) < 0) error(1, errno, "child: can't setgid 0");
+        if (setresuid(0, 0, 0) < 0) error(1, errno, "child: can't setuid 0");
+    }
 
     if (getuid() != 0) error(1, 0, "child: I am not uid 0, but %d!\n", getuid());
     if (getpid() != 1) error(1, 0, "child: I am not pid 1, but %d!\n", getpid());
@@ -255,30 +670,28 @@ child_func(void *arg)
     if (mount("", "/", "", MS_PRIVATE | MS_REC, 0) < 0)
         error(1, errno, "child: can't remount / as private");
 
-    progress("child: mounting /proc ..\n");
-    target_mount(cc->rootfs, "/proc", "proc",  MS_NOEXEC|MS_NOSUID|MS_NODEV);
+    progress("child: setting up rootfs %s ..\n", cc->rootfs);
+    if (Legacymount || setup_root_fd(cc) == -ENOSYS) setup_root(cc);
 
-    // Don't mount a new /dev; we can't make device nodes! The
-    // rootfs should come with a /dev.
-    //target_mount(cc->rootfs, "/dev",  "tmpfs", MS_NOEXEC|MS_NOSUID);
+    // Hand the parent a watch on our root mount; -1 if we can't.
+    if (Record) {
+        int fan = prefetch_watch(), r;
 
-    /*
-     * XXX Once we pivot, it appears that we lose the ability to mount
-     *     file systems. I don't understand why this restriction for
-     *     namespaced children.
-     */
-    progress("child: setting up rootfs %s ..\n", cc->rootfs);
-    switchroot(cc->rootfs);
+        if (fan < 0) error(0, -fan, "child: can't watch / for --record-prefetch");
+        if ((r = send_fd(cc->fd, fan)) < 0) error(0, -r, "child: can't send fanotify fd");
+        if (fan >= 0) close(fan);
+    }
 
     progress("child: exec'ing init %s ..\n", cc->init);
 
     char * const argv[2] = { cc->init, 0 };
-    const char * envp[5] = { "PATH=/sbin:/bin:/usr/sbin:/usr/bin", 0, 0, 0, 0 };
+    const char * envp[6] = { "PATH=/sbin:/bin:/usr/sbin:/usr/bin", 0, 0, 0, 0, 0 };
     int j = 1;
 
     // Tell the script whether we have two other options set.
-    if (Userns) envp[j++] = "CLONE_USERNS=1";
-    if (Netns)  envp[j++] = "CLONE_NETNS=1";
+    if (Userns) envp[j++] = "CLONE_NEWUSER=1";
+    if (Netns)  envp[j++] = "CLONE_NEWNET=1";
+    if (Veth)   envp[j++] = "NS_VETH=1";
 
     // This macro is defined in GNUmakefile depending on whether
     // this is a release build or a debug build.
@@ -286,211 +699,764 @@ child_func(void *arg)
     envp[j++] = "DEBUG=1";
 #endif
 
+    trace_mark("exec");
+    if (Tracefile) trace_send(cc->fd);
+
     execvpe(cc->init, argv, (char *const *)envp);
     error(1, errno, "child: execvpe of init failed");
     return 0;
 }
 
 
-#define STACK_SIZE  (4 * 1048576)
-#define STACK_SIZE_WORDS (STACK_SIZE / sizeof(uint64_t))
-uint64_t Stack[STACK_SIZE_WORDS];
-
 /*
- * Usage:
- *    $0 pre-exec.sh /path/to/rootfs post-exec.sh unpriv-uid unpriv-gid
+ * Wait for the parent to release us; the release message is
+ * "rootfs\0init\0upper\0".
  */
-int
-main(int argc, char * const argv[])
+static void
+child_config(container_config *cc)
 {
-    program_name = argv[0];
-
-    int r = parse_options(argc, argv);
-    argc -= r;
-    argv  = &argv[r];
+    static char buf[2 * PATH_MAX];
+    size_t n = wait_socketio(cc->fd, buf, sizeof buf - 1, "parent");
+    char *e  = buf + n;
 
-    if (argc < 3) {
-        usage("Insufficient arguments!");
-        exit(1);
-    }
-
-
-    char * const preexec  = argv[0];
-    char * const rootfs   = argv[1];
-    char * const postexec = argv[2];
-
-    int pfd[2];
-    int uid = 0,
-        gid = 0,
-        fd  = 0;    // parent's end of socketpair()
+    *e = 0;
+    cc->rootfs = buf;
+    cc->init   = buf + strlen(buf) + 1;
+    if (cc->init >= e) die("child: malformed config from parent");
 
-    argc -= 3;
-    argv  = &argv[3];
+    cc->upper  = cc->init + strlen(cc->init) + 1;
+    if (cc->upper >= e) die("child: malformed config from parent");
+}
 
-    validate_exe("/",    preexec);
-    validate_exe(rootfs, postexec);
 
-    int flags;
-    container_config cc = { .rootfs = rootfs, .init = postexec, };
+// Stack for a kid cloned with clone(); it only runs child_func()
+#define STACK_SIZE  (128 * 1024)
 
-    /* bi-directional pipe to communicate with kid and vice-versa */
-    if (socketpair(AF_LOCAL, SOCK_SEQPACKET, 0, pfd) < 0)
-        error(1, errno, "can't create socketpair");
 
+/*
+ * clone() needs a stack for the kid: map one with a guard page
+ * below it. The kid gets a copy-on-write copy of our memory (no
+ * CLONE_VM); so we unmap ours right away and the kid's goes away
+ * when it exec's.
+ */
+static pid_t
+clone_child(int flags, container_config *cc, int *pidfd)
+{
+    size_t pg = sysconf(_SC_PAGESIZE);
+    char  *stk = mmap(0, pg + STACK_SIZE, PROT_READ|PROT_WRITE,
+                      MAP_PRIVATE|MAP_ANONYMOUS|MAP_STACK|MAP_NORESERVE, -1, 0);
 
-    cc.fd  = pfd[0];
-    fd     = pfd[1];
+    if (stk == MAP_FAILED) error(1, errno, "can't map a stack for the kid");
+    if (mprotect(stk, pg, PROT_NONE) < 0) error(1, errno, "can't make the kid's stack guard page");
 
-    flags  = CLONE_NEWNS | CLONE_NEWPID | CLONE_NEWUTS;
-    //flags |= CLONE_NEWIPC;
+    char *top = stk + pg + STACK_SIZE;
+    pid_t kid = clone(child_func, top, flags|CLONE_PIDFD|SIGCHLD, cc, pidfd);
 
-#if 0
-    // XXX Not supported on android!
-    flags |= CLONE_NEWCGROUP;
-#endif
+    if (kid < 0 && errno == EINVAL) {
+        // Before Linux 5.2: no CLONE_PIDFD; open one after the fact.
+        kid = clone(child_func, top, flags|SIGCHLD, cc);
+        if (kid > 0 && (*pidfd = pidfd_of(kid)) < 0) error(1, -*pidfd, "can't open pidfd for %d", kid);
+    }
 
-    if (Netns) flags  |= CLONE_NEWNET;
+    int err = errno;
+    munmap(stk, pg + STACK_SIZE);
+    errno = err;
+    return kid;
+}
 
-    if (Userns) {
-        if (argc < 2) {
-            usage("Insufficient arguments!");
-            exit(1);
-        }
 
-        const char *ustr = argv[0];
-        const char *gstr = argv[1];
+/*
+ * Clone a new kid in namespaces 'flags'. The kid waits for the
+ * parent to release it via release_child(). Returns the kid's pid
+ * and the parent's end of the socketpair in 'fdp'.
+ */
+pid_t
+spawn_child(int flags, cgroup *cg, int *fdp, int *pidfdp)
+{
+    container_config cc = { .rootfs = 0, .init = 0, .mntfd = -1 };
+    int pfd[2];
 
-        uid = parse_uidgid(ustr);
-        gid = parse_uidgid(gstr);
+    /* bi-directional pipe to communicate with kid and vice-versa */
+    if (socketpair(AF_LOCAL, SOCK_SEQPACKET|SOCK_CLOEXEC, 0, pfd) < 0)
+        error(1, errno, "can't create socketpair");
 
-        int euid = geteuid();
+    cc.fd  = pfd[0];
+    cc.pfd = pfd[1];
 
-        if (euid != 0) check_unpriv_userns(euid);
+    pid_t kid   = -1;
+    int   pidfd = -1;
 
-        flags |= CLONE_NEWUSER;
+#ifdef CLONE_INTO_CGROUP
+    /*
+     * Without a stack clone3() has fork() semantics: the kid runs
+     * on a copy of our stack and needs none of its own. On v2 it
+     * also puts the kid in its cgroup atomically; so it is charged
+     * from its first page. Linux 5.3 - 5.6 have clone3() but not
+     * CLONE_INTO_CGROUP; older kernels fall back to clone().
+     */
+    struct clone_args ca = {
+        .flags       = (uint64_t)flags | CLONE_PIDFD,
+        .pidfd       = (uint64_t)(uintptr_t)&pidfd,
+        .exit_signal = SIGCHLD,
+    };
+
+    if (cg && cg->fd >= 0) {
+        ca.flags  |= CLONE_INTO_CGROUP;
+        ca.cgroup  = cg->fd;
+        kid = syscall(SYS_clone3, &ca, sizeof ca);
+        if (kid > 0) cg = 0;
+        if (kid < 0) {
+            ca.flags  &= ~(uint64_t)CLONE_INTO_CGROUP;
+            ca.cgroup  = 0;
+        }
     }
 
-    char dbuf[128];
-    progress("parent: starting new namespace (%s)..\n", flags2str(dbuf, sizeof dbuf, flags));
+    if (kid < 0) kid = syscall(SYS_clone3, &ca, sizeof ca);
+    if (kid == 0) _exit(child_func(&cc));
+#endif
 
-    pid_t kid = clone(child_func, Stack+STACK_SIZE_WORDS, flags |SIGCHLD, &cc);
+    if (kid < 0) kid = clone_child(flags, &cc, &pidfd);
     if (kid == (pid_t)-1) error(1, errno, "can't clone");
 
-    progress("parent: cloned child %d ..\n", kid);
-
-    if (Userns) {
-        progress("parent: fixing up container uid/gid to %d/%d\n", uid, gid);
-
-        /*
-         * Now, remap the ZERO uid/pid in the cloned namespace.
-         */
-        writemap("/proc/%d/uid_map", kid, uid);
-
-        update_setgroups(kid, "deny");
-        writemap("/proc/%d/gid_map", kid, gid);
+    if (cg) {
+        int r = cgroup_attach(cg, kid);
+        if (r < 0) error(1, -r, "can't move %d to cgroup %s", kid, cg->name);
     }
 
-    if (Memlimit > 0) {
-        progress("parent: Limiting container to %d bytes of memory ..\n", Memlimit);
-        limit_memory(kid, Memlimit);
-    }
+    close(pfd[0]);
+    *fdp    = pfd[1];
+    *pidfdp = pidfd;
+    return kid;
+}
 
-    progress("parent: running %s before handing control to kid ..\n", preexec);
-    run_exe(preexec, kid);
 
-    /*
-     * Finally, signal the kid that we are ready to go; we do this
-     * by closing tne pipe.
-     */
-    progress("parent: resuming container child ..\n");
-    signal_socketio(fd, 1, "kid");
+/*
+ * Release the kid waiting on 'fd' to setup 'rootfs' and exec
+ * 'init'.
+ */
+int
+release_child(int fd, const char *rootfs, const char *init, const char *upper)
+{
+    char buf[2 * PATH_MAX];
+    if (!upper) upper = "";
 
-    close(pfd[0]);
+    size_t a = strlen(rootfs) + 1;
+    size_t b = strlen(init) + 1;
+    size_t c = strlen(upper) + 1;
 
-    reap_child(kid, 0);
-    progress("parent: Done\n");
+    if ((a + b + c) > sizeof buf) die("rootfs/init/upper paths are too long");
+
+    memcpy(buf, rootfs, a);
+    memcpy(buf+a, init, b);
+    memcpy(buf+a+b, upper, c);
 
+    // A kid that died leaves a closed socket; no SIGPIPE for us.
+    if (send(fd, buf, a+b+c, MSG_NOSIGNAL) != (ssize_t)(a+b+c)) return -errno;
     return 0;
 }
 
 
-static int
-check_unpriv_userns(int euid)
+void
+prefetch_path(char *buf, size_t n, const char *rootfs)
 {
-    char buf[32];
-    const char *procf = "/proc/sys/kernel/unprivileged_userns_clone";
-    int         fd    = open(procf, O_RDONLY);
+    char lower[PATH_MAX];
 
-    if (fd < 0)                        error(1, errno, "can't open %s", procf);
-    if (read(fd, buf, sizeof buf) < 0) error(1, errno, "i/o error while reading %s", procf);
-    close(fd);
+    if (Image)      rootfs = Image;
+    else if (Lower) {
+        snprintf(lower, sizeof lower, "%.*s", (int)strcspn(Lower, ":"), Lower);
+        rootfs = lower;
+    }
+    prefetch_manifest(buf, n, rootfs);
+}
 
-    if (buf[0] == '1') return 0;
 
-    die("Unprivileged user (uid %d) can't create user namespace.\n"
-        "   %s  is 0", euid, procf);
+void
+start_prefetch(const char *rootfs)
+{
+    char manifest[PATH_MAX];
 
-    return 0;
-}
+    // The image is mounted only in the kid; nothing to read through.
+    if (Image) return;
 
+    prefetch_path(manifest, sizeof manifest, rootfs);
 
-static int
-reap_child(pid_t kid, int opt)
-{
-    int r = 0;
+    int r = prefetch_replay(manifest, Lower ? Lower : rootfs);
+    if (r < 0) {
+        if (r != -ENOENT) error(0, -r, "can't read prefetch manifest %s", manifest);
+        return;
+    }
+    progress("parent: prefetching %d ranges from %s ..\n", r, manifest);
+}
 
-    progress("parent: checking on child %d to exit..\n", kid);
 
-    pid_t p = waitpid(kid, &r, opt);
+int
+send_idmap(int fd, pid_t kid, const char *rootfs)
+{
+    char path[64];
+    int  r;
 
-    if (p == 0) return 0;
-    if (p == (pid_t)-1) error(1, errno, "waitpid on %d failed", kid);
+    snprintf(path, sizeof path, "/proc/%d/ns/user", kid);
 
-    if (WIFEXITED(r)) {
-        int x = WEXITSTATUS(r);
-        if (x != 0) die("kid exited with non-zero code %d", x);
+    int ns = open(path, O_RDONLY|O_CLOEXEC);
+    if (ns < 0) return -errno;
 
-        return 1;   // success
-    } else if (WIFSIGNALED(r)) {
-        int sig = WTERMSIG(r);
-        die("kid caught signal %d and aborted", sig);
-    }
+    int mfd = mountfd_idmap(rootfs, ns);
+    close(ns);
+    if (mfd < 0) return mfd;
 
-    return 0;
+    r = send_fd(fd, mfd);
+    close(mfd);
+    return r;
 }
 
 
-static void
-wait_socketio(int fd, const char *who)
+int
+attach_image(void)
 {
-    char c;
+    int fd = image_attach(Image, Imagedev, sizeof Imagedev, &Imagefs);
 
-    if (1 != read(fd, &c, 1)) error(1, 0, "incomplete pipe read from %s", who);
+    if (fd == -EMEDIUMTYPE) die("%s is not a squashfs or erofs image", Image);
+    if (fd < 0) error(1, -fd, "can't attach %s to a loop device", Image);
+
+    progress("parent: attached %s (%s) to %s\n", Image, Imagefs, Imagedev);
+    return fd;
 }
 
 
-static void
-signal_socketio(int fd, int eof, const char *who)
+int
+make_upper(const char *dir, int uid, int gid)
 {
-    char c = 1;
+    static const char *sub[] = { "upper", "work" };
+    char path[PATH_MAX];
+    int i, r;
 
-    if (1 != write(fd, &c, 1)) error(1, 0, "incomplete pipe write to %s", who);
-    if (eof) close(fd);
+    for (i = 0; i < 2; i++) {
+        snprintf(path, sizeof path, "%s/%s", dir, sub[i]);
+        if ((r = maybe_mkdir(path, 0755)) < 0) return r;
+
+        // The overlay is mounted by the kid's (mapped) root
+        if (Userns && chown(path, uid, gid) < 0) return -errno;
+    }
+    return 0;
 }
 
 
 /*
- * Parse uid or gid in a string.
+ * Remap the ZERO uid/gid in the user namespace of 'kid'.
  */
-static int
-parse_uidgid(const char *str)
+void
+map_ids(pid_t kid, int uid, int gid)
 {
-    int id = 0;
-    int c;
+    progress("parent: fixing up container uid/gid to %d/%d\n", uid, gid);
 
-    if ((c = *str) == '-') error(1, 0, "uid/gid %s can't be negative", str);
+    writemap("/proc/%d/uid_map", kid, uid);
 
-    while ((c = *str++)) {
+    update_setgroups(kid, "deny");
+    writemap("/proc/%d/gid_map", kid, gid);
+}
+
+/*
+ * Usage:
+ *    $0 pre-exec.sh /path/to/rootfs post-exec.sh unpriv-uid unpriv-gid
+ */
+int
+main(int argc, char * const argv[])
+{
+    program_name = argv[0];
+    trace_mark("start");
+
+    int r = parse_options(argc, argv);
+    argc -= r;
+    argv  = &argv[r];
+
+    if (argc == 2 && 0 == strcmp(argv[0], "netpool")) {
+        netpool_fill(Netpool ? Netpool : NETPOOL_DIR, parse_uidgid(argv[1]));
+        return 0;
+    }
+
+    if (argc >= 2 && 0 == strcmp(argv[0], "daemon"))
+        return nsd_main(argc-1, &argv[1]);
+
+    if (argc == 5 && 0 == strcmp(argv[0], "launch"))
+        return nsd_request(argv[1], argv[0], 3, &argv[2]);
+
+    if (argc == 6 && 0 == strcmp(argv[0], "launch")) {
+        char  share[96];
+        char *req[4] = { argv[2], argv[3], argv[4], parse_share(share, sizeof share, argv[5]) };
+
+        return nsd_request(argv[1], argv[0], 4, req);
+    }
+
+    if (argc == 3 && 0 == strcmp(argv[0], "stop"))
+        return nsd_request(argv[1], argv[0], 1, &argv[2]);
+
+    if (argc == 2 && 0 == strcmp(argv[0], "status"))
+        return nsd_request(argv[1], argv[0], 0, &argv[2]);
+
+    if (argc == 2 && 0 == strcmp(argv[0], "freeze"))
+        return freeze(argv[1], 1);
+
+    if (argc == 2 && 0 == strcmp(argv[0], "thaw"))
+        return freeze(argv[1], 0);
+
+    if (Membudget) die("--memory-budget is only for the daemon");
+
+    if (argc < 3) {
+        usage("Insufficient arguments!");
+        exit(1);
+    }
+
+
+    launch_config lc = { .pre = argv[0], .rootfs = argv[1], .init = argv[2] };
+
+    argc -= 3;
+    argv  = &argv[3];
+
+    if (strcmp(lc.pre, "-") != 0) validate_exe("/", lc.pre);
+
+    char err[PATH_MAX+64];
+    if (check_init(lc.rootfs, lc.init, err, sizeof err) < 0) die("%s", err);
+
+    lc.flags  = CLONE_NEWNS | CLONE_NEWPID | CLONE_NEWUTS;
+    //lc.flags |= CLONE_NEWIPC;
+
+#if 0
+    // XXX Not supported on android!
+    lc.flags |= CLONE_NEWCGROUP;
+#endif
+
+    if (Userns) {
+        if (argc < 2) {
+            usage("Insufficient arguments!");
+            exit(1);
+        }
+
+        const char *ustr = argv[0];
+        const char *gstr = argv[1];
+
+        lc.uid = parse_uidgid(ustr);
+        lc.gid = parse_uidgid(gstr);
+
+        int euid = geteuid();
+
+        if (euid != 0) check_unpriv_userns(euid);
+
+        lc.flags |= CLONE_NEWUSER;
+    }
+
+    if (Upper && (r = make_upper(Upper, lc.uid, lc.gid)) < 0)
+        error(1, -r, "can't make overlay dirs in %s", Upper);
+
+    if (Prefetch) {
+        start_prefetch(lc.rootfs);
+        trace_mark("prefetch");
+    }
+
+    int imgfd = -1;
+    if (Image) {
+        imgfd = attach_image();
+        trace_mark("loop");
+    }
+
+    int st, oomed;
+
+    while (st = run(&lc, &oomed), oomed && lc.restart < Restarts) {
+        lc.backoff = oom_backoff(lc.restart++);
+        progress("parent: restart %d of %d in %d ms ..\n", lc.restart, Restarts, lc.backoff);
+
+        usleep(lc.backoff * 1000);
+        trace_reset();
+        trace_mark("restart");
+    }
+
+    // The kid's mount is gone with it; this frees the loop device.
+    if (imgfd >= 0) close(imgfd);
+
+    progress("parent: Done\n");
+    return exit_code(st);
+}
+
+
+/*
+ * Start the container of 'lc' and wait for it to exit; return its
+ * wait status. '*oomed' is set if it died after an OOM.
+ */
+static int
+run(launch_config *lc, int *oomed)
+{
+    int flags = lc->flags;
+    int fd    = 0;  // parent's end of socketpair()
+    int r;
+
+    /*
+     * A pooled netns is entered by the parent before clone(); the
+     * kid inherits it. If the pool is empty, clone a new one.
+     */
+    int  netfd = -1;
+    char pooled[IFNAMSIZ] = "";
+
+    if (Netns && Netpool) {
+        netfd = netpool_take(Netpool, pooled, sizeof pooled);
+        if (netfd < 0) progress("parent: netns pool %s is empty ..\n", Netpool);
+        trace_mark("netns");
+    }
+
+    if (Netns && netfd < 0) flags |= CLONE_NEWNET;
+
+    char dbuf[128];
+    progress("parent: starting new namespace (%s)..\n", flags2str(dbuf, sizeof dbuf, flags));
+
+    /*
+     * The cgroup is ready before clone; so the kid is charged from
+     * its first page.
+     */
+    cgroup cg;
+    char   cgname[32];
+
+    snprintf(cgname, sizeof cgname, "%d", getpid());
+    int limited = setup_cgroup(&cg, cgname);
+    if (limited < 0) exit(1);
+    if (limited) trace_mark("cgroup");
+
+    // Opened before the kid joins the cgroup (v1 makes dirs)
+    stats sts = { .n = 0 };
+    if (limited && Statsinterval) stats_open(&sts, &cg);
+
+    adapt ad = { .trig = -1 };
+    if (Adaptmax && (r = adapt_open(&ad, &cg, Adaptmin, Adaptmax)) < 0)
+        error(1, -r, "can't set up --memory-adapt for cgroup %s", cg.name);
+    if (Adaptmax)
+        progress("parent: memory.high adapts between %" PRIu64 " and %" PRIu64 " bytes ..\n",
+                 Adaptmin, Adaptmax);
+
+    idle idl = { .cpu = -1 };
+    if (Idlereclaim && (r = idle_open(&idl, &cg)) < 0)
+        error(1, -r, "can't set up --idle-reclaim for cgroup %s", cg.name);
+
+    oom om = { .fd = -1, .ctl = -1 };
+    if (limited && watch_oom() && (r = oom_open(&om, &cg)) < 0)
+        error(1, -r, "can't watch cgroup %s for OOM kills", cg.name);
+
+    int selfnet = netfd >= 0 ? enter_netns(netfd) : -1;
+
+    int   pidfd;
+    pid_t kid = spawn_child(flags, limited ? &cg : 0, &fd, &pidfd);
+
+    if (netfd >= 0) {
+        if (setns(selfnet, CLONE_NEWNET) < 0) error(1, errno, "can't return to my netns");
+        close(selfnet);
+        close(netfd);
+        progress("parent: using pooled netns %s ..\n", pooled);
+    }
+    trace_mark("clone");
+
+    progress("parent: cloned child %d ..\n", kid);
+    sts.pid = kid;
+    ad.pid  = kid;
+    idl.pid = kid;
+    om.pid  = kid;
+
+    if (Userns) {
+        map_ids(kid, lc->uid, lc->gid);
+        trace_mark("idmap");
+    }
+
+    set_ioprio(kid);
+
+    if (Veth) {
+        progress("parent: plumbing veth %s:%s ..\n", Veth->host, Veth->cont);
+        setup_veth(kid, Veth, pooled[0] ? pooled : 0);
+        trace_mark("veth");
+    }
+
+    int script = strcmp(lc->pre, "-") != 0;
+
+    if (Hook) {
+        progress("parent: calling hook %s ..\n", Hook);
+        if ((r = run_hook(kid, lc->rootfs, lc->init, pooled, lc->uid, lc->gid)) < 0) exit(1);
+        trace_mark("hook");
+        script = script && r == NS_HOOK_SCRIPT;
+    }
+
+    if (script) {
+        progress("parent: running %s before handing control to kid ..\n", lc->pre);
+        if (run_exe(lc->pre, kid, pooled) < 0) exit(1);
+        trace_mark("preexec");
+    }
+
+    /*
+     * Finally, signal the kid that we are ready to go; we do this
+     * by sending it the rootfs and init.
+     */
+    if (Idmap) {
+        if ((r = send_idmap(fd, kid, lc->rootfs)) < 0)
+            error(1, -r, "can't send idmapped %s to kid %d", lc->rootfs, kid);
+        trace_mark("idtree");
+    }
+
+    progress("parent: resuming container child ..\n");
+    trace_mark("release");
+    r = release_child(fd, lc->rootfs, lc->init, Upper);
+    if (r < 0) error(1, -r, "can't release kid %d", kid);
+
+    /*
+     * If tracing, the kid sends its timestamps just before it
+     * exec's init. That completes the startup trace.
+     */
+    int fan = Record ? recv_fd(fd) : -1;
+
+    if (Tracefile) {
+        int r = trace_recv(fd);
+        if (r < 0) error(0, r, "can't receive trace from kid");
+
+        trace_write(Tracefile, kid);
+    }
+    close(fd);
+
+    if (lc->restart) {
+        uint64_t down = trace_now() / 1000000 - lc->died;
+
+        stats_event(kid, "restart",
+                    "\"restart\":%d,\"max\":%d,\"backoff_ms\":%d,\"down_ms\":%llu,\"start_ms\":%llu",
+                    lc->restart, Restarts, lc->backoff, (unsigned long long)down,
+                    (unsigned long long)(down - lc->backoff));
+    }
+
+    if (fan >= 0) {
+        char manifest[PATH_MAX];
+
+        prefetch_path(manifest, sizeof manifest, lc->rootfs);
+        progress("parent: recording startup of %d to %s ..\n", kid, manifest);
+
+        r = prefetch_record(fan, pidfd, manifest, PREFETCH_RECORD_MS);
+        if (r < 0) error(0, -r, "can't record prefetch manifest %s", manifest);
+        else       progress("parent: recorded %d files in %s\n", r, manifest);
+    }
+
+    // Now that the kid is on its way, replace what we took.
+    if (pooled[0]) netpool_refill(Netpool);
+
+    int st = reap_child(kid, pidfd, &sts, &ad, &idl, &om);
+
+    lc->died = trace_now() / 1000000;
+    *oomed   = 0;
+
+    // The last counts can come in after the kid is gone
+    if (om.fd >= 0) {
+        oom_event(&om);
+        *oomed = st != 0 && om.oom + om.kill > 0;
+        oom_close(&om);
+    }
+
+    stats_close(&sts);
+    if (Adaptmax)    adapt_close(&ad);
+    if (Idlereclaim) idle_close(&idl);
+    if (limited) cgroup_destroy(&cg);
+    return st;
+}
+
+
+int
+check_unpriv_userns(int euid)
+{
+    char buf[32];
+    const char *procf = "/proc/sys/kernel/unprivileged_userns_clone";
+    int         fd    = open(procf, O_RDONLY);
+
+    if (fd < 0)                        error(1, errno, "can't open %s", procf);
+    if (read(fd, buf, sizeof buf) < 0) error(1, errno, "i/o error while reading %s", procf);
+    close(fd);
+
+    if (buf[0] == '1') return 0;
+
+    die("Unprivileged user (uid %d) can't create user namespace.\n"
+        "   %s  is 0", euid, procf);
+
+    return 0;
+}
+
+
+/*
+ * Freeze or thaw the container whose cgroup is 'id' and print how
+ * long it took.
+ */
+static int
+freeze(const char *id, int on)
+{
+    char *end = 0;
+    long  pid = strtol(id, &end, 10);
+    char  name[32];
+    uint64_t t0;
+    int r;
+
+    // Only a number; it goes into a path.
+    if (!end || *end || pid <= 0) die("invalid container id %s", id);
+    snprintf(name, sizeof name, "%ld", pid);
+
+    t0 = trace_now();
+    r  = cgroup_freeze(name, on, FREEZE_TIMEOUT_MS);
+    if (r == -ENOENT) die("no container %s with a cgroup", id);
+    if (r < 0) error(1, -r, "can't %s container %s", on ? "freeze" : "thaw", id);
+
+    printf("%s %s in %" PRIu64 " us\n", name, on ? "frozen" : "thawed", (trace_now() - t0) / 1000);
+    return 0;
+}
+
+
+/*
+ * Wait for the kid to exit; return its wait status. Meanwhile, 's'
+ * is sampled every --stats-interval, 'a' follows the memory
+ * pressure of the kid, 'd' reclaims its memory when it is idle and
+ * 'o' logs its OOMs -- and kills it if the kernel doesn't.
+ */
+static int
+reap_child(pid_t kid, int pidfd, stats *s, adapt *a, idle *d, oom *o)
+{
+    uint64_t now   = trace_now() / 1000000;
+    uint64_t tstat = now + Statsinterval;
+    uint64_t tadpt = now + ADAPT_TICK_MS;
+    uint64_t tidle = now + IDLE_TICK_MS;
+    int r = 0, e;
+
+    progress("parent: checking on child %d to exit..\n", kid);
+
+    for (;;) {
+        struct pollfd pfd[3] = {
+              { .fd = pidfd,   .events = POLLIN }
+            , { .fd = a->trig, .events = POLLPRI }  // ignored if -1
+            , { .fd = o->fd,   .events = o->events }
+        };
+        uint64_t next = UINT64_MAX;
+        int ms = -1;
+
+        if (s->n > 0)     next = tstat;
+        if (a->trig >= 0 && tadpt < next) next = tadpt;
+        if (d->cpu >= 0  && tidle < next) next = tidle;
+        if (next != UINT64_MAX) ms = next > now ? (int)(next - now) : 0;
+
+        if (poll(pfd, 3, ms) < 0 && errno != EINTR) error(1, errno, "can't wait for %d", kid);
+        if (pfd[0].revents) break;
+
+        if (pfd[1].revents & POLLPRI) adapt_pressure(a);
+
+        if ((pfd[2].revents & o->events) && oom_event(o) > 0 && !o->group) {
+            progress("parent: child %d ran out of memory; killing it ..\n", kid);
+            if ((e = pidfd_kill(pidfd, SIGKILL)) < 0 && e != -ESRCH)
+                error(0, -e, "can't kill %d", kid);
+        }
+
+        now = trace_now() / 1000000;
+        if (s->n > 0 && now >= tstat) {
+            stats_sample(s);
+            tstat = now + Statsinterval;
+        }
+        if (a->trig >= 0 && now >= tadpt) {
+            adapt_tick(a);
+            tadpt = now + ADAPT_TICK_MS;
+        }
+        if (d->cpu >= 0 && now >= tidle) {
+            idle_tick(d, Idlereclaim);
+            tidle = now + IDLE_TICK_MS;
+        }
+    }
+
+    if ((e = pidfd_wait(pidfd, kid, &r, -1)) < 0) error(1, -e, "wait on %d failed", kid);
+
+    close(pidfd);
+    return r;
+}
+
+
+/*
+ * Return 0 if wait status 'r' is a clean exit; die otherwise.
+ */
+static int
+exit_code(int r)
+{
+    if (WIFEXITED(r)) {
+        int x = WEXITSTATUS(r);
+        if (x != 0) die("kid exited with non-zero code %d", x);
+    } else if (WIFSIGNALED(r)) {
+        int sig = WTERMSIG(r);
+        die("kid caught signal %d and aborted", sig);
+    }
+
+    return 0;
+}
+
+
+static size_t
+wait_socketio(int fd, void *buf, size_t n, const char *who)
+{
+    ssize_t m = read(fd, buf, n);
+
+    if (m <= 0) error(1, m < 0 ? errno : 0, "incomplete pipe read from %s", who);
+    return m;
+}
+
+
+/*
+ * Pass 'fd' to the other end of 'sock'; a message without one if
+ * 'fd' is -1.
+ */
+static int
+send_fd(int sock, int fd)
+{
+    char c = 'F';
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    struct iovec  iov = { .iov_base = &c, .iov_len = 1 };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+    if (fd >= 0) {
+        memset(cbuf, 0, sizeof cbuf);
+        msg.msg_control    = cbuf;
+        msg.msg_controllen = sizeof cbuf;
+
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type  = SCM_RIGHTS;
+        cm->cmsg_len   = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cm), &fd, sizeof fd);
+    }
+
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) < 0) return -errno;
+    return 0;
+}
+
+
+// Receive an fd sent with send_fd(); -1 if there was none
+static int
+recv_fd(int sock)
+{
+    char c;
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    struct iovec  iov = { .iov_base = &c, .iov_len = 1 };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1,
+                          .msg_control = cbuf, .msg_controllen = sizeof cbuf };
+    int fd = -1;
+
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) <= 0) return -1;
+
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    if (cm && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS)
+        memcpy(&fd, CMSG_DATA(cm), sizeof fd);
+    return fd;
+}
+
+
+
+/*
+ * Parse uid or gid in a string.
+ */
+int
+parse_uidgid(const char *str)
+{
+    int id = 0;
+    int c;
+
+    if ((c = *str) == '-') error(1, 0, "uid/gid %s can't be negative", str);
+
+    while ((c = *str++)) {
         if (!isdigit(c)) error(1, 0, "invalid character '%c' in uid/gid '%s", c, str);
         id *= 10;
         id += c - '0';
@@ -503,23 +1469,81 @@ parse_uidgid(const char *str)
 /*
  * Validate 'exe' residing under 'root' to be executable.
  */
-static void
+void
 validate_exe(const char *root, const char *exe)
+{
+    char err[PATH_MAX+64];
+
+    if (check_exe(root, exe, err, sizeof err) < 0) die("%s", err);
+}
+
+
+/*
+ * Same as validate_exe(); but return -1 and describe the problem
+ * in 'err' instead of dying.
+ */
+int
+check_exe(const char *root, const char *exe, char *err, size_t n)
 {
     struct stat st;
     char path[PATH_MAX];
 
-    if (exe[0]  != '/')        die("%s is not an absolute path", exe);
-    if (root[0] != '/')        die("%s is not an absolute path", root);
-    if (lstat(root, &st) < 0)  error(1, errno, "can't stat '%s'", root);
-    if (!S_ISDIR(st.st_mode))  die("%s is not a directory", root);
+#define _fail(...)  do { snprintf(err, n, __VA_ARGS__); return -1; } while (0)
+
+    if (exe[0]  != '/')        _fail("%s is not an absolute path", exe);
+    if (root[0] != '/')        _fail("%s is not an absolute path", root);
+    if (lstat(root, &st) < 0)  _fail("can't stat '%s': %s", root, strerror(errno));
+    if (!S_ISDIR(st.st_mode))  _fail("%s is not a directory", root);
 
     exe++;
     snprintf(path, sizeof path, "%s/%s", root, exe);
 
-    if (lstat(path, &st) < 0)  error(1, errno, "can't stat '%s'", path);
-    if (!S_ISREG(st.st_mode))  die("%s is not a file", path);
-    if ((st.st_mode & 0500) != 0500)  die("%s is not executable", path);
+    if (lstat(path, &st) < 0)  _fail("can't stat '%s': %s", path, strerror(errno));
+    if (!S_ISREG(st.st_mode))  _fail("%s is not a file", path);
+    if ((st.st_mode & 0500) != 0500)  _fail("%s is not executable", path);
+
+#undef _fail
+    return 0;
+}
+
+
+int
+check_init(const char *rootfs, const char *init, char *err, size_t n)
+{
+    struct stat st;
+    char lower[PATH_MAX];
+    char first[PATH_MAX+64] = "";
+    char *p, *q;
+
+    if (!Lower && !Image) return check_exe(rootfs, init, err, n);
+
+    if (rootfs[0] != '/' || lstat(rootfs, &st) < 0 || !S_ISDIR(st.st_mode)) {
+        snprintf(err, n, "%s is not an absolute path to a directory", rootfs);
+        return -1;
+    }
+
+    // We can't look inside the image; the kid's exec will tell.
+    if (Image) {
+        if (init[0] == '/') return 0;
+
+        snprintf(err, n, "%s is not an absolute path", init);
+        return -1;
+    }
+
+    /*
+     * The topmost lower dir with 'init' wins; the same as the
+     * overlay. Report the problem with the topmost dir.
+     */
+    snprintf(lower, sizeof lower, "%s", Lower);
+    for (p = lower; p; p = q) {
+        if ((q = strchr(p, ':'))) *q++ = 0;
+
+        if (check_exe(p, init, err, n) == 0) return 0;
+        if (!first[0]) snprintf(first, sizeof first, "%s", err);
+    }
+
+    snprintf(err, n, "%s", first);
+    return -1;
 }
 
 
@@ -529,67 +1553,336 @@ validate_exe(const char *root, const char *exe)
 static void
 writemap(const char *fmt, pid_t kid, int id)
 {
-    char file[PATH_MAX];
+    char file[PATH_MAX];
+
+    snprintf(file, sizeof file, fmt, kid);
+
+    int fd = open(file, O_CLOEXEC|O_WRONLY);
+    if (fd < 0) error(1, errno, "can't open %s", file);
+    if (dprintf(fd, "0 %d 1\n", id) < 0) error(1, errno, "i/o error while writing to %s", file);
+    close(fd);
+
+    progress("parent: remapped UID/GID %d to 0 for child namespace.\n", id);
+}
+
+
+/*
+ * Scripts run in /tmp. posix_spawn() can only chdir with
+ * posix_spawn_file_actions_addchdir_np() (glibc 2.29+); elsewhere
+ * the helper is forked.
+ */
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 29)
+#define SPAWN_CHDIR     1
+#endif
+
+
+#ifdef SPAWN_CHDIR
+/*
+ * fork() copies the page tables of the parent -- a daemon with a
+ * large address space pays for that on every launch. posix_spawn()
+ * (glibc: clone(CLONE_VM|CLONE_VFORK)) shares them until the exec;
+ * it also reports exec failures to us rather than in the child.
+ */
+static int
+spawn_argv(char * const argv[], char * const env[], pid_t *pidp)
+{
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t a;
+    sigset_t none;
+    int r;
+
+    // Don't pass on signals blocked by a daemon parent
+    sigemptyset(&none);
+    posix_spawnattr_init(&a);
+    posix_spawnattr_setsigmask(&a, &none);
+    posix_spawnattr_setpgroup(&a, 0);
+    posix_spawnattr_setflags(&a, POSIX_SPAWN_SETSIGMASK|POSIX_SPAWN_SETPGROUP);
+
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_addchdir_np(&fa, "/tmp");
+
+    r = posix_spawn(pidp, argv[0], &fa, &a, argv, env);
+    posix_spawn_file_actions_destroy(&fa);
+    posix_spawnattr_destroy(&a);
+    return -r;
+}
+
+#else
+
+/*
+ * Same as above with fork(); a close-on-exec pipe carries the errno
+ * of a failed chdir() or exec back to us.
+ */
+static int
+spawn_argv(char * const argv[], char * const env[], pid_t *pidp)
+{
+    sigset_t none;
+    pid_t pid;
+    int fd[2];
+    int e = 0;
+
+    if (pipe2(fd, O_CLOEXEC) < 0) return -errno;
+
+    pid = fork();
+    if (pid < 0) {
+        e = errno;
+        close(fd[0]);
+        close(fd[1]);
+        return -e;
+    }
+
+    if (pid == 0) {
+        // Don't pass on signals blocked by a daemon parent
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, 0);
+        setpgid(0, 0);
+
+        if (chdir("/tmp") == 0) execve(argv[0], argv, env);
+        e = errno;
+        if (write(fd[1], &e, sizeof e) < 0) {}
+        _exit(127);
+    }
+
+    close(fd[1]);
+    if (read(fd[0], &e, sizeof e) == sizeof e) {
+        waitpid(pid, 0, 0);
+        close(fd[0]);
+        return -e;
+    }
+    close(fd[0]);
+
+    *pidp = pid;
+    return 0;
+}
+#endif /* SPAWN_CHDIR */
+
+
+/*
+ * Start an external program in its own process group; returns a
+ * pidfd for it and its pid in 'pidp' or -errno if it can't be
+ * started.
+ */
+static int
+start_argv(char * const argv[], char * const env[], pid_t *pidp)
+{
+    pid_t pid;
+    int r;
+
+    if ((r = spawn_argv(argv, env, &pid)) < 0) return r;
+
+    int pidfd = pidfd_of(pid);
+    if (pidfd < 0) error(1, -pidfd, "can't open pidfd for %s", argv[0]);
+
+    *pidp = pid;
+    return pidfd;
+}
+
+
+int
+start_exe(char * const exe, pid_t kid, const char *pooled, pid_t *pidp)
+{
+    char b[32]; snprintf(b, sizeof b, "%d", kid);
+    char p[64];
+    char * const pargs[] = { exe, b, 0 };
+    const char * envp[6] = { "PATH=/sbin:/bin:/usr/sbin:/usr/bin", 0, 0, 0, 0, 0 };
+    int j = 1;
+
+    // Tell the script whether we have two other options set.
+    if (Userns) envp[j++] = "CLONE_NEWUSER=1";
+    if (Netns)  envp[j++] = "CLONE_NEWNET=1";
+    if (Veth)   envp[j++] = "NS_VETH=1";
+
+    // The pooled netns comes with a veth pair; name its host end.
+    if (pooled && !Veth) {
+        snprintf(p, sizeof p, "NS_POOL_VETH=%s", pooled);
+        envp[j++] = p;
+    }
+
+    return start_argv(pargs, (char * const *)envp, pidp);
+}
+
+
+/*
+ * Kill a helper and everything it started. Its process group can't
+ * be recycled until we reap the helper; so this is race-free too.
+ */
+void
+kill_exe(int pidfd, pid_t pid)
+{
+    pidfd_kill(pidfd, SIGKILL);
+    kill(-pid, SIGKILL);
+}
+
+
+int
+exe_status(const char *exe, int r)
+{
+    if (WIFEXITED(r)) {
+        int x = WEXITSTATUS(r);
+        if (x != 0) {
+            warn("%s exited with non-zero code %d", exe, x);
+            return -1;
+        }
+    } else if (WIFSIGNALED(r)) {
+        int sig = WTERMSIG(r);
+        warn("%s caught signal %d and aborted", exe, sig);
+        return -1;
+    }
+    return 0;
+}
+
+
+int
+run_exe(char * const exe, pid_t kid, const char *pooled)
+{
+    pid_t pid;
+    int   st;
+    int   pidfd = start_exe(exe, kid, pooled, &pid);
+
+    if (pidfd < 0) error(1, -pidfd, "can't start %s", exe);
+
+    int   r     = pidfd_wait(pidfd, pid, &st, Pretimeout > 0 ? Pretimeout : -1);
+
+    if (r == -ETIMEDOUT) {
+        warn("%s is still running after %d ms; killing it", exe, Pretimeout);
+        kill_exe(pidfd, pid);
+        r = pidfd_wait(pidfd, pid, &st, -1);
+    }
+    close(pidfd);
+
+    if (r < 0) error(1, -r, "can't wait for %s", exe);
+    return exe_status(exe, st);
+}
+
+
+int
+run_hook(pid_t kid, const char *rootfs, const char *init, const char *pooled, int uid, int gid)
+{
+    struct ns_hook_config cfg = {
+        .version   = NS_HOOK_VERSION,
+        .rootfs    = rootfs,
+        .init      = init,
+        .pool_veth = pooled && *pooled && !Veth ? pooled : 0,
+        .veth      = !!Veth,
+        .uid       = uid,
+        .gid       = gid,
+    };
+
+    // The namespaces the container has; not how it got them (a
+    // pooled netns isn't cloned).
+    int flags = CLONE_NEWNS | CLONE_NEWPID | CLONE_NEWUTS;
+
+    if (Userns) flags |= CLONE_NEWUSER;
+    if (Netns)  flags |= CLONE_NEWNET;
+
+    int r = hook_pre_exec(kid, flags, &cfg);
+    if (r < 0) {
+        warn("%s failed: %s", Hook, strerror(-r));
+        return -1;
+    }
+    return r;
+}
+
+
+/*
+ * Parse a veth spec of the form host:cont,addr/prefix,gw
+ */
+static void
+parse_veth(veth_config *v, const char *str)
+{
+    char buf[256];
+    char *host, *cont, *addr, *pfx, *gw;
 
-    snprintf(file, sizeof file, fmt, kid);
+    if (strlen(str) >= sizeof buf) die("veth spec '%s' is too long", str);
+    strcpy(buf, str);
 
-    int fd = open(file, O_CLOEXEC|O_WRONLY);
-    if (fd < 0) error(1, errno, "can't open %s", file);
-    if (dprintf(fd, "0 %d 1\n", id) < 0) error(1, errno, "i/o error while writing to %s", file);
-    close(fd);
+    host = buf;
+    if (!(cont = strchr(host, ':'))) goto bad;
+    *cont++ = 0;
+    if (!(addr = strchr(cont, ','))) goto bad;
+    *addr++ = 0;
+    if (!(gw = strchr(addr, ',')))   goto bad;
+    *gw++ = 0;
+    if (!(pfx = strchr(addr, '/')))  goto bad;
+    *pfx++ = 0;
 
-    progress("parent: remapped UID/GID %d to 0 for child namespace.\n", id);
+    if (!*host || strlen(host) >= IFNAMSIZ) die("invalid host interface name '%s'", host);
+    if (!*cont || strlen(cont) >= IFNAMSIZ) die("invalid container interface name '%s'", cont);
+
+    strcpy(v->host, host);
+    strcpy(v->cont, cont);
+
+    if (1 != inet_pton(AF_INET, addr, &v->addr)) die("invalid IPv4 address '%s'", addr);
+    if (1 != inet_pton(AF_INET, gw,   &v->gw))   die("invalid IPv4 gateway '%s'", gw);
+
+    v->prefix = parse_uidgid(pfx);
+    if (v->prefix < 1 || v->prefix > 32) die("invalid prefix length '%s'", pfx);
+    return;
+
+bad:
+    die("malformed veth spec '%s'; expected host:cont,addr/prefix,gw", str);
 }
 
 
 /*
- * Run an external program; die on error.
+ * Create a veth pair for the container 'kid' and configure both
+ * ends via rtnetlink; this does what examples/pre.sh and
+ * examples/init.sh do with 'ip' - without any process creation.
  *
- * Returns Only if external program ran successfully and exited with
- * a zero code.
+ * If the kid is in a pooled netns, the pair exists already with
+ * host end 'pooled'; we just rename both ends.
  */
 static void
-run_argv(char * const argv[], char * const env[])
+setup_veth(pid_t kid, const veth_config *v, const char *pooled)
 {
-    const char * const exe = argv[0];
-
-    pid_t pid = fork();
-    if (pid == -1) error(1, errno, "can't fork %s", exe);
+    int nl, idx, r;
 
-    if (pid == 0) { // child
+    if ((nl = nl_open()) < 0) error(1, -nl, "can't open netlink socket");
 
-        chdir("/tmp");
-        execve(exe, argv, env);
-        error(1, errno, "can't exec %s", exe);
+    if (pooled) {
+        if ((idx = nl_ifindex(nl, pooled)) < 0) error(1, -idx, "can't find %s", pooled);
+        if ((r = nl_link_rename(nl, idx, v->host)) < 0) error(1, -r, "can't rename %s to %s", pooled, v->host);
     } else {
-        // parent. Wait for child to finish.
-        int r = 0;
-        waitpid(pid, &r, 0);
-
-        if (WIFEXITED(r)) {
-            int x = WEXITSTATUS(r);
-            if (x != 0) die("%s exited with non-zero code %d", exe, x);
-        } else if (WIFSIGNALED(r)) {
-            int sig = WTERMSIG(r);
-            die("%s caught signal %d and aborted", exe, sig);
-        }
+        r = nl_veth_create(nl, v->host, v->cont, kid);
+        if (r < 0) error(1, -r, "can't create veth pair %s:%s", v->host, v->cont);
+
+        if ((idx = nl_ifindex(nl, v->host)) < 0) error(1, -idx, "can't find %s", v->host);
+    }
+    if ((r = nl_addr_add(nl, idx, v->gw, v->prefix)) < 0) error(1, -r, "can't set address of %s", v->host);
+    if ((r = nl_link_up(nl, idx)) < 0) error(1, -r, "can't bring up %s", v->host);
+    close(nl);
+
+    // Now, the container side
+    if ((nl = nl_open_pid(kid)) < 0) error(1, -nl, "can't open netlink socket in netns of %d", kid);
+
+    if ((idx = nl_ifindex(nl, "lo")) < 0) error(1, -idx, "can't find lo in netns of %d", kid);
+    if ((r = nl_link_up(nl, idx)) < 0) error(1, -r, "can't bring up lo in netns of %d", kid);
+
+    if (pooled && strcmp(v->cont, NETPOOL_PEER) != 0) {
+        if ((idx = nl_ifindex(nl, NETPOOL_PEER)) < 0) error(1, -idx, "can't find %s in netns of %d", NETPOOL_PEER, kid);
+        if ((r = nl_link_rename(nl, idx, v->cont)) < 0) error(1, -r, "can't rename %s to %s", NETPOOL_PEER, v->cont);
     }
+
+    if ((idx = nl_ifindex(nl, v->cont)) < 0) error(1, -idx, "can't find %s in netns of %d", v->cont, kid);
+    if ((r = nl_addr_add(nl, idx, v->addr, v->prefix)) < 0) error(1, -r, "can't set address of %s", v->cont);
+    if ((r = nl_link_up(nl, idx)) < 0) error(1, -r, "can't bring up %s", v->cont);
+    if ((r = nl_route_default(nl, v->gw)) < 0) error(1, -r, "can't add default route via %s", v->cont);
+    close(nl);
 }
 
 
-static void
-run_exe(char * const exe, pid_t kid)
+/*
+ * Switch to the netns 'nsfd'; return an fd for our current netns
+ * so the caller can return to it.
+ */
+static int
+enter_netns(int nsfd)
 {
-    char b[32]; snprintf(b, sizeof b, "%d", kid);
-    char * const pargs[] = { exe, b, 0 };
-    const char * envp[4] = { "PATH=/sbin:/bin:/usr/sbin:/usr/bin", 0, 0, 0 };
-    int j = 1;
-
-    // Tell the script whether we have two other options set.
-    if (Userns) envp[j++] = "CLONE_USERNS=1";
-    if (Netns)  envp[j++] = "CLONE_NETNS=1";
+    int self = open("/proc/self/ns/net", O_RDONLY|O_CLOEXEC);
 
-    run_argv(pargs, (char * const *)envp);
+    if (self < 0) error(1, errno, "can't open my netns");
+    if (setns(nsfd, CLONE_NEWNET) < 0) error(1, errno, "can't enter pooled netns");
+    return self;
 }
 
 
@@ -696,40 +1989,255 @@ make_devs(char *const rootfs, const device *d)
 
 
 /*
- * Write a 64-bit value to dir/file.
+ * Report a failed write of 'file' to 'cg'; returns 'r'.
  */
-static void
-write64(const char *dir, const char *file, uint64_t val)
+static int
+write_err(cgroup *cg, const char *file, int r)
 {
-    char path[PATH_MAX];
+    error(0, -r, "can't write %s to cgroup %s", file, cg->name);
+    return r;
+}
 
-    snprintf(path, sizeof path, "%s/%s", dir, file);
 
-    int fd   = open(path, O_CLOEXEC|O_RDWR|O_CREAT, 0600);
-    if (fd < 0) error(1, errno, "can't open %s", path);
-    if (dprintf(fd, "%" PRIu64 "\n", val) < 0) error(1, errno, "i/o error while writing to %s", path);
-    close(fd);
+/*
+ * Write a 64-bit value to a cgroup file. Returns 0 or -errno.
+ */
+static int
+write64(cgroup *cg, const char *ctl, const char *file, uint64_t val)
+{
+    int r = cgroup_write(cg, ctl, file, "%" PRIu64, val);
+
+    return r < 0 ? write_err(cg, file, r) : 0;
 }
 
 
 /*
- * Limit the child container to 'memlimit' bytes of memory.
- * We do this by writing to a cgroup file:
- *      /sys/fs/cgroup/memory/$PID/memory.limit_in_bytes
+ * Write a --swap or --zswap value: a size or "max".
  */
-static void
-limit_memory(pid_t pid, uint64_t memlimit)
+static int
+write_swap(cgroup *cg, const char *file, uint64_t val)
+{
+    if (val == SWAP_UNLIMITED) return cgroup_write(cg, "memory", file, "max");
+    return cgroup_write(cg, "memory", file, "%" PRIu64, val);
+}
+
+
+/*
+ * Limit the container to 'memlimit' bytes of memory (0 is no
+ * limit) and --swap bytes of swap (none by default); on v2 also
+ * apply the zswap options. Returns 0 or -errno.
+ */
+static int
+limit_memory(cgroup *cg, uint64_t memlimit)
+{
+    int r;
+
+    if (memlimit)
+        progress("parent: Limiting container to %" PRIu64 " bytes of memory ..\n", memlimit);
+
+    if (cgroup_version() == CGROUP_V2) {
+        if (memlimit && (r = write64(cg, "memory", "memory.max", memlimit)) < 0) return r;
+
+        // memory.swap.max is absent without swap; fine if none is wanted.
+        r = write_swap(cg, "memory.swap.max", Swaplimit);
+        if (r < 0 && !(r == -ENOENT && Swaplimit == 0))
+            return write_err(cg, "memory.swap.max", r);
+
+        if (Zswapset && (r = write_swap(cg, "memory.zswap.max", Zswapmax)) < 0)
+            return write_err(cg, "memory.zswap.max", r);
+
+        // Linux 6.8+
+        if (Zswapwb >= 0 && (r = cgroup_write(cg, "memory", "memory.zswap.writeback", "%d", Zswapwb)) < 0)
+            return write_err(cg, "memory.zswap.writeback", r);
+        return 0;
+    }
+
+    if (!memlimit) return 0;  // swap is unlimited too
+
+    if ((r = write64(cg, "memory", "memory.limit_in_bytes", memlimit)) < 0) return r;
+    if (Swaplimit == SWAP_UNLIMITED) {
+        r = cgroup_write(cg, "memory", "memory.memsw.limit_in_bytes", "-1");
+        return r < 0 ? write_err(cg, "memory.memsw.limit_in_bytes", r) : 0;
+    }
+    return write64(cg, "memory", "memory.memsw.limit_in_bytes", memlimit + Swaplimit);
+}
+
+
+/*
+ * Apply --cpus, --cpu-weight and --cpuset. cpu.max/cfs quota are
+ * per CFS_PERIOD microseconds. Returns 0 or -errno.
+ */
+#define CFS_PERIOD  100000
+
+static int
+limit_cpu(cgroup *cg)
 {
-    char dir[PATH_MAX];
+    int v2 = cgroup_version() == CGROUP_V2;
+    uint64_t quota = (uint64_t)Cpus * CFS_PERIOD / 1000;
     int r;
 
-    snprintf(dir, sizeof dir, "/sys/fs/cgroup/memory/%d", pid);
-    r = maybe_mkdir(dir, 0700);
-    if (r < 0) error(1, -r, "can't setup memory cgroup for %d", pid);
+    if (Cpus > 0) {
+        progress("parent: Limiting container to %u.%03u cpus ..\n", Cpus / 1000, Cpus % 1000);
+        if (v2) {
+            r = cgroup_write(cg, "cpu", "cpu.max", "%" PRIu64 " %d", quota, CFS_PERIOD);
+            if (r < 0) return write_err(cg, "cpu.max", r);
+        } else {
+            if ((r = write64(cg, "cpu", "cpu.cfs_period_us", CFS_PERIOD)) < 0) return r;
+            if ((r = write64(cg, "cpu", "cpu.cfs_quota_us", quota)) < 0)       return r;
+        }
+    }
+
+    // v1 cpu.shares of 1024 is the same as the v2 default weight of 100
+    if (Cpuweight > 0) {
+        if (v2) r = write64(cg, "cpu", "cpu.weight", Cpuweight);
+        else    r = write64(cg, "cpu", "cpu.shares", Cpuweight * 1024 / 100);
+        if (r < 0) return r;
+    }
+
+    if (Cpuset) {
+        char cpus[1024], mems[64] = "";
+        const char *list = Cpuset;
+
+        if (0 == strcmp(Cpuset, "auto")) {
+            int ncpu = Cpus > 0 ? (Cpus + 999) / 1000 : 1;
+
+            r = place_cpus(ncpu, cpus, sizeof cpus, mems, sizeof mems);
+            if (r < 0) {
+                error(0, -r, "can't place container on cpus");
+                return r;
+            }
+            list = cpus;
+        }
+
+        progress("parent: Pinning container to cpus %s (mems '%s') ..\n", list, mems);
+        r = cgroup_write(cg, "cpuset", "cpuset.cpus", "%s", list);
+        if (r < 0) {
+            error(0, -r, "can't write cpuset.cpus %s to cgroup %s", list, cg->name);
+            return r;
+        }
+
+        if (mems[0]) {
+            r = cgroup_write(cg, "cpuset", "cpuset.mems", "%s", mems);
+            if (r < 0) {
+                error(0, -r, "can't write cpuset.mems %s to cgroup %s", mems, cg->name);
+                return r;
+            }
+        }
+    }
+    return 0;
+}
+
+
+/*
+ * Apply --io-max and --io-weight. The weight is honored by the
+ * iocost or BFQ schedulers; it is a no-op (with a warning) where
+ * neither is available. Returns 0 or -errno.
+ */
+static int
+limit_io(cgroup *cg)
+{
+    int v2 = cgroup_version() == CGROUP_V2;
+    int i, r;
+
+    for (i = 0; i < Niomax; i++) {
+        io_limit *io = &Iomax[i];
+
+        progress("parent: Limiting container I/O on %u:%u ..\n", io->maj, io->min);
+        if (v2) {
+            char buf[160];
+            int  n = snprintf(buf, sizeof buf, "%u:%u", io->maj, io->min);
+
+#define _iokey(k)   if (io->k) n += snprintf(buf+n, sizeof buf - n, " " #k "=%" PRIu64, io->k)
+            _iokey(rbps);
+            _iokey(wbps);
+            _iokey(riops);
+            _iokey(wiops);
+#undef _iokey
+
+            r = cgroup_write(cg, "io", "io.max", "%s", buf);
+            if (r < 0) {
+                error(0, -r, "can't write io.max '%s' to cgroup %s", buf, cg->name);
+                return r;
+            }
+            continue;
+        }
+
+#define _iofile(k, f)   do { \
+            if (!io->k) break; \
+            r = cgroup_write(cg, "blkio", "blkio.throttle." f, "%u:%u %" PRIu64, io->maj, io->min, io->k); \
+            if (r < 0) return write_err(cg, "blkio.throttle." f, r); \
+        } while (0)
+
+        _iofile(rbps,  "read_bps_device");
+        _iofile(wbps,  "write_bps_device");
+        _iofile(riops, "read_iops_device");
+        _iofile(wiops, "write_iops_device");
+#undef _iofile
+    }
+
+    if (Ioweight > 0) {
+        // BFQ and v1 blkio.weight take 1-1000 and 10-1000. Like
+        // cpu.shares, blkio.weight is scaled so that the default of
+        // 100 is its own default (500).
+        int w  = Ioweight > 1000 ? 1000 : Ioweight;
+        int w1 = Ioweight * 5 < 10 ? 10 : (Ioweight * 5 > 1000 ? 1000 : Ioweight * 5);
+
+        if (v2) {
+            r = cgroup_write(cg, "io", "io.weight", "default %d", Ioweight);
+            if (r == -ENOENT) r = cgroup_write(cg, "io", "io.bfq.weight", "default %d", w);
+        } else {
+            r = cgroup_write(cg, "blkio", "blkio.weight", "%d", w1);
+            if (r == -ENOENT) r = cgroup_write(cg, "blkio", "blkio.bfq.weight", "%d", w);
+        }
+        if (r < 0) error(0, -r, "can't set I/O weight of cgroup %s", cg->name);
+    }
+    return 0;
+}
+
+
+/*
+ * Containers with a memory limit to run into (or that --restart
+ * after an OOM kill) are watched for OOM kills.
+ */
+int
+watch_oom(void)
+{
+    return Memlimit || Adaptmax || Membudget || Restarts;
+}
+
+
+int
+setup_cgroup(cgroup *cg, const char *name)
+{
+    if (Memlimit == 0 && Adaptmax == 0 && Membudget == 0 && Idlereclaim == 0 && Restarts == 0 &&
+        !Swapset && !Zswapset && Zswapwb < 0 && Cpus == 0 && Cpuweight == 0 && !Cpuset &&
+        Niomax == 0 && Ioweight == 0 && !Statsinterval) return 0;
+
+    int r = cgroup_create(cg, name);
+    if (r < 0) {
+        error(0, -r, "can't make cgroup %s", name);
+        goto fail;
+    }
+
+    if ((Memlimit > 0 || Swapset || Zswapset || Zswapwb >= 0) && (r = limit_memory(cg, Memlimit)) < 0)
+        goto fail;
+    if ((r = limit_cpu(cg)) < 0) goto fail;
+    if ((r = limit_io(cg)) < 0)  goto fail;
+    return 1;
+
+fail:
+    cgroup_destroy(cg);
+    return r;
+}
+
 
-    write64(dir, "memory.limit_in_bytes", memlimit);
-    write64(dir, "memory.memsw.limit_in_bytes", 0); // no swap space!
-    write64(dir, "cgroup.procs", pid);
+void
+set_ioprio(pid_t kid)
+{
+    if (Ioprio == 0) return;
+
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, kid, Ioprio) < 0)
+        error(1, errno, "can't set I/O priority of %d", kid);
 }
 
 // Turn CLONE_xxx flags to string
@@ -802,11 +2310,39 @@ static const struct option Longopt[] =
       {"help",                  no_argument, 0,       'h'}
     , {"verbose",               no_argument, 0,       'v'}
     , {"memory",                required_argument, 0, 'm'}
+    , {"memory-adapt",          required_argument, 0, 'a'}
+    , {"memory-budget",         required_argument, 0, 'G'}
+    , {"idle-reclaim",          required_argument, 0, 'Q'}
+    , {"restart",               required_argument, 0, 'r'}
+    , {"swap",                  required_argument, 0, 'W'}
+    , {"zswap",                 required_argument, 0, 'Z'}
+    , {"zswap-writeback",       required_argument, 0, 'k'}
     , {"network",               no_argument, 0,       'n'}
     , {"user",                  no_argument, 0,       'u'}
+    , {"trace",                 required_argument, 0, 't'}
+    , {"veth",                  required_argument, 0, 'e'}
+    , {"netns-pool",            required_argument, 0, 'P'}
+    , {"zygotes",               required_argument, 0, 'z'}
+    , {"cpus",                  required_argument, 0, 'c'}
+    , {"cpuset",                required_argument, 0, 's'}
+    , {"cpu-weight",            required_argument, 0, 'w'}
+    , {"io-max",                required_argument, 0, 'b'}
+    , {"io-weight",             required_argument, 0, 'B'}
+    , {"io-prio",               required_argument, 0, 'p'}
+    , {"pre-timeout",           required_argument, 0, 'T'}
+    , {"lower",                 required_argument, 0, 'L'}
+    , {"upper",                 required_argument, 0, 'U'}
+    , {"image",                 required_argument, 0, 'I'}
+    , {"record-prefetch",       no_argument, 0,       'R'}
+    , {"prefetch",              no_argument, 0,       'f'}
+    , {"idmap",                 no_argument, 0,       'i'}
+    , {"legacy-mount",          no_argument, 0,       'M'}
+    , {"hook",                  required_argument, 0, 'H'}
+    , {"stats-interval",        required_argument, 0, 'S'}
+    , {"stats-to",              required_argument, 0, 'O'}
     , {0, 0, 0, 0}
 };
-static const char Shortopt[] = "hvm:nu";
+static const char Shortopt[] = "hvm:a:G:Q:r:W:Z:k:nut:e:P:z:c:s:w:b:B:p:T:L:U:I:RfiMH:S:O:";
 
 static int
 parse_options(int argc, char * const argv[])
@@ -824,6 +2360,39 @@ parse_options(int argc, char * const argv[])
                 if (optarg && *optarg) Memlimit = grok_size(optarg, "memory");
                 break;
 
+            case 'a':
+                parse_adapt(optarg);
+                break;
+
+            case 'G':
+                Membudget = grok_size(optarg, "memory-budget");
+                break;
+
+            case 'Q':
+                Idlereclaim = parse_uidgid(optarg);
+                if (Idlereclaim < 1) die("--idle-reclaim must be at least 1 ms");
+                break;
+
+            case 'r':
+                Restarts = parse_uidgid(optarg);
+                break;
+
+            case 'W':
+                Swaplimit = grok_swap(optarg, "swap");
+                Swapset   = 1;
+                break;
+
+            case 'Z':
+                Zswapmax = grok_swap(optarg, "zswap");
+                Zswapset = 1;
+                break;
+
+            case 'k':
+                if      (0 == strcmp(optarg, "on"))  Zswapwb = 1;
+                else if (0 == strcmp(optarg, "off")) Zswapwb = 0;
+                else die("--zswap-writeback is 'on' or 'off'");
+                break;
+
             case 'v':  /* verbose */
                 Verbose = 1;
                 break;
@@ -836,6 +2405,100 @@ parse_options(int argc, char * const argv[])
                 Userns = 1;
                 break;
 
+            case 't':
+                Tracefile = optarg;
+                break;
+
+            case 'P':
+                Netpool = optarg;
+                break;
+
+            case 'z':
+                Zygotes = parse_uidgid(optarg);
+                break;
+
+            case 'c':
+                Cpus = grok_cpus(optarg);
+                break;
+
+            case 's':
+                Cpuset = optarg;
+                break;
+
+            case 'w':
+                Cpuweight = parse_uidgid(optarg);
+                if (Cpuweight < 1 || Cpuweight > 10000) die("--cpu-weight must be between 1 and 10000");
+                break;
+
+            case 'b':
+                if (Niomax == IOMAX_DEVS) die("too many --io-max devices (max %d)", IOMAX_DEVS);
+                parse_iomax(&Iomax[Niomax++], optarg);
+                break;
+
+            case 'B':
+                Ioweight = parse_uidgid(optarg);
+                if (Ioweight < 1 || Ioweight > 10000) die("--io-weight must be between 1 and 10000");
+                break;
+
+            case 'p':
+                Ioprio = parse_ioprio(optarg);
+                break;
+
+            case 'T':
+                Pretimeout = parse_uidgid(optarg) * 1000;
+                break;
+
+            case 'L':
+                Lower = optarg;
+                break;
+
+            case 'I':
+                Image = optarg;
+                break;
+
+            case 'R':
+                Record = 1;
+                break;
+
+            case 'f':
+                Prefetch = 1;
+                break;
+
+            case 'i':
+                Idmap = 1;
+                break;
+
+            case 'M':
+                Legacymount = 1;
+                break;
+
+            case 'H':
+                Hook = optarg;
+                break;
+
+            case 'S':
+                Statsinterval = parse_uidgid(optarg);
+                if (Statsinterval < 1) die("--stats-interval must be at least 1 ms");
+                break;
+
+            case 'O':
+                Statsto = optarg;
+                break;
+
+            case 'U':
+                if (optarg[0] != '/') die("--upper %s is not an absolute path", optarg);
+                Upper = optarg;
+                break;
+
+            case 'e': {
+                static veth_config v;
+
+                parse_veth(&v, optarg);
+                Veth  = &v;
+                Netns = 1;
+                break;
+            }
+
             default:
                 ++errs;
                 break;
@@ -843,11 +2506,222 @@ parse_options(int argc, char * const argv[])
     }
 
     if (errs > 0) die("too many errors");
+    if (Upper && !Lower) die("--upper needs --lower");
+    if (Image && Lower)  die("--image and --lower can't be used together");
+
+    // Neither squashfs nor erofs can be mounted in a user namespace
+    if (Image && Userns) die("--image can't be used with --user");
+
+    // fanotify mount marks need the host's CAP_SYS_ADMIN
+    if (Record && Userns) die("--record-prefetch can't be used with --user");
+
+    if (Idmap && !Userns) die("--idmap needs --user");
+    if (Idmap && Lower)   die("--idmap can't be used with --lower");
+
+    // Once; the daemon calls it for every launch
+    char err[PATH_MAX+64];
+    if (Hook && hook_load(Hook, err, sizeof err) < 0) die("%s", err);
+
+    if (Adaptmax) {
+        if (cgroup_version() != CGROUP_V2) die("--memory-adapt needs cgroup v2 (memory.high and PSI)");
+        if (Memlimit && Memlimit < Adaptmax) die("--memory must be at least the --memory-adapt maximum");
+        if (Membudget) die("--memory-adapt and --memory-budget both set memory.high");
+    }
+
+    if (cgroup_version() == CGROUP_V1) {
+        // memory.memsw.limit_in_bytes is memory + swap
+        if (Swapset && !Memlimit && Swaplimit != SWAP_UNLIMITED)
+            die("--swap needs --memory on cgroup v1");
+        if (Zswapset || Zswapwb >= 0) die("--zswap and --zswap-writeback need cgroup v2");
+    }
+
+    if (Statsto && !Statsinterval) die("--stats-to needs --stats-interval");
+    if (Statsinterval) {
+        const char *dest = Statsto ? Statsto : "-";
+        int r = stats_output(dest);
+
+        if (r < 0) error(1, -r, "can't open stats output %s", dest);
+    }
 
     return optind;
 }
 
 
+/*
+ * Parse a --swap or --zswap value: a size as for --memory,
+ * "unlimited" or "max".
+ */
+static uint64_t
+grok_swap(const char *str, const char *option)
+{
+    if (0 == strcmp(str, "unlimited") || 0 == strcmp(str, "max")) return SWAP_UNLIMITED;
+    return grok_size(str, option);
+}
+
+
+/*
+ * Parse the --memory-adapt bounds MIN:MAX; each with the same
+ * suffixes as --memory.
+ */
+static void
+parse_adapt(const char *str)
+{
+    char buf[64];
+    char *max;
+
+    if (strlen(str) >= sizeof buf) die("memory-adapt spec '%s' is too long", str);
+    strcpy(buf, str);
+
+    if (!(max = strchr(buf, ':'))) die("memory-adapt '%s' is not MIN:MAX", str);
+    *max++ = 0;
+
+    Adaptmin = grok_size(buf, "memory-adapt");
+    Adaptmax = grok_size(max, "memory-adapt");
+    if (Adaptmin == 0 || Adaptmax < Adaptmin) die("memory-adapt needs 0 < MIN <= MAX");
+}
+
+
+/*
+ * Parse the memory share of a daemon launch: key=val[,key=val..]
+ * where key is one of prio, min, max. Sizes have the same suffixes
+ * as --memory. The daemon gets it as "PRIO:MIN:MAX" in 'buf'; a
+ * missing MAX is 0.
+ */
+static char *
+parse_share(char *buf, size_t n, const char *str)
+{
+    char spec[128];
+    char *kv, *next;
+    uint64_t min = 0, max = 0;
+    int prio = ARBITER_PRIO;
+
+    if (strlen(str) >= sizeof spec) die("share '%s' is too long", str);
+    strcpy(spec, str);
+
+    for (kv = spec; kv; kv = next) {
+        char *val;
+
+        if ((next = strchr(kv, ','))) *next++ = 0;
+        if (!(val = strchr(kv, '='))) die("share '%s' is not key=val,..", str);
+        *val++ = 0;
+
+        if      (0 == strcmp(kv, "min"))  min  = grok_size(val, "share min");
+        else if (0 == strcmp(kv, "max"))  max  = grok_size(val, "share max");
+        else if (0 == strcmp(kv, "prio")) prio = parse_uidgid(val);
+        else die("share '%s': unknown key '%s'", str, kv);
+    }
+
+    if (prio < 1 || prio > 10000) die("share priority must be 1-10000");
+    if (max && max < min)         die("share max is less than its min");
+
+    snprintf(buf, n, "%d:%llu:%llu", prio, (unsigned long long)min, (unsigned long long)max);
+    return buf;
+}
+
+
+/*
+ * Parse an I/O limit: DEV,key=val[,key=val..] where DEV is a block
+ * device node or MAJ:MIN and key is one of rbps, wbps, riops, wiops.
+ * Values can have the same suffixes as --memory.
+ */
+static void
+parse_iomax(io_limit *io, const char *str)
+{
+    char buf[256];
+    char *dev, *kv, *next;
+
+    if (strlen(str) >= sizeof buf) die("io-max spec '%s' is too long", str);
+    strcpy(buf, str);
+    memset(io, 0, sizeof *io);
+
+    dev = buf;
+    if (!(kv = strchr(dev, ','))) goto bad;
+    *kv++ = 0;
+
+    if (dev[0] == '/') {
+        struct stat st;
+
+        if (stat(dev, &st) < 0)    error(1, errno, "can't stat %s", dev);
+        if (!S_ISBLK(st.st_mode))  die("%s is not a block device", dev);
+        io->maj = major(st.st_rdev);
+        io->min = minor(st.st_rdev);
+    } else if (2 != sscanf(dev, "%u:%u", &io->maj, &io->min)) {
+        goto bad;
+    }
+
+    for (; kv; kv = next) {
+        char *val;
+
+        if ((next = strchr(kv, ','))) *next++ = 0;
+        if (!(val = strchr(kv, '='))) goto bad;
+        *val++ = 0;
+
+        uint64_t v = grok_size(val, "io-max");
+        if      (0 == strcmp(kv, "rbps"))  io->rbps  = v;
+        else if (0 == strcmp(kv, "wbps"))  io->wbps  = v;
+        else if (0 == strcmp(kv, "riops")) io->riops = v;
+        else if (0 == strcmp(kv, "wiops")) io->wiops = v;
+        else goto bad;
+    }
+    return;
+
+bad:
+    die("malformed io-max spec '%s'; expected dev,rbps=N,wbps=N,riops=N,wiops=N", str);
+}
+
+
+/*
+ * Parse an I/O priority: CLASS[:LEVEL] where CLASS is rt, be or
+ * idle and LEVEL is 0 (highest) to 7 [4].
+ */
+static int
+parse_ioprio(const char *str)
+{
+    static const char *classes[] = { "rt", "be", "idle", 0 };
+    const char *lvl = strchr(str, ':');
+    size_t n = lvl ? (size_t)(lvl - str) : strlen(str);
+    int i, level = 4;
+
+    for (i = 0; classes[i]; i++) {
+        if (n == strlen(classes[i]) && 0 == strncmp(str, classes[i], n)) break;
+    }
+    if (!classes[i]) die("invalid io-prio class in '%s'; expected rt, be or idle", str);
+
+    if (lvl) {
+        level = parse_uidgid(lvl+1);
+        if (level > 7) die("io-prio level must be between 0 and 7");
+    }
+
+    // idle has no levels
+    return ((i + 1) << IOPRIO_CLASS_SHIFT) | (i == 2 ? 0 : level);
+}
+
+
+/*
+ * Parse a cpu count with up to three decimals ("1.5") into 1/1000
+ * cpus.
+ */
+static uint32_t
+grok_cpus(const char *str)
+{
+    char *end = 0;
+    unsigned long n = strtoul(str, &end, 10);
+    uint32_t frac = 0, scale = 100;
+
+    if (end == str) die("invalid --cpus value '%s'", str);
+    if (*end == '.') {
+        for (end++; isdigit(*end) && scale > 0; end++, scale /= 10)
+            frac += (*end - '0') * scale;
+    }
+    if (*end) die("invalid --cpus value '%s'", str);
+
+    // Below 0.01, the quota is less than the kernel's 1ms minimum
+    uint64_t v = (uint64_t)n * 1000 + frac;
+    if (v < 10 || v > 1000000) die("--cpus must be between 0.01 and 1000");
+    return v;
+}
+
+
 static uint64_t
 grok_size(const char * str, const char * option)
 {
@@ -0,0 +1,210 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * ns.h - interfaces shared by the 'ns' launcher and its daemon
+ *        modes.
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+
+#ifndef ___NS_H__Vt6oS9eJx2MbQ4Rn___
+#define ___NS_H__Vt6oS9eJx2MbQ4Rn___ 1
+
+    /* Provide C linkage for symbols declared here .. */
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <net/if.h>
+#include <netinet/in.h>
+
+#include "cgroup.h"
+
+// --veth host:cont,addr/prefix,gw
+struct veth_config
+{
+    char host[IFNAMSIZ];    // name of the veth end in the parent ns
+    char cont[IFNAMSIZ];    // name of the veth end in the container
+    struct in_addr addr;    // container address
+    struct in_addr gw;      // host address & default gateway
+    int  prefix;
+};
+typedef struct veth_config veth_config;
+
+
+/*
+ * Globals set from the command line (ns.c)
+ */
+extern uint64_t     Memlimit;
+extern uint64_t     Adaptmin;   // --memory-adapt bounds; 0 if off
+extern uint64_t     Adaptmax;
+extern uint64_t     Membudget;  // --memory-budget; daemon only
+extern int          Idlereclaim; // ms; 0 is off
+extern int          Restarts;   // --restart after an OOM kill
+extern uint64_t     Swaplimit;  // --swap; SWAP_UNLIMITED for no limit
+extern int          Swapset;
+extern uint64_t     Zswapmax;   // --zswap
+extern int          Zswapset;
+extern int          Zswapwb;    // --zswap-writeback; -1 if unset
+
+#define SWAP_UNLIMITED  UINT64_MAX
+extern uint32_t     Cpus;       // cpu bandwidth in 1/1000 cpus
+extern const char  *Cpuset;     // cpu list or "auto"
+extern int          Cpuweight;
+extern int          Ioweight;
+extern int          Ioprio;     // ioprio_set(2) value; 0 if unset
+extern int          Pretimeout; // ms; 0 is no limit
+extern const char  *Lower;      // overlayfs lower dirs "a:b:.."
+extern const char  *Upper;      // overlayfs upper/work parent dir
+extern const char  *Image;      // squashfs/erofs rootfs image
+extern int          Record;     // --record-prefetch
+extern int          Prefetch;   // --prefetch
+extern int          Idmap;      // --idmap
+extern const char  *Hook;       // pre-exec hook shared object
+extern int          Statsinterval; // ms; 0 is no telemetry
+extern int          Verbose;
+extern int          Netns;
+extern int          Userns;
+extern const char  *Tracefile;
+extern veth_config *Veth;
+extern const char  *Netpool;
+extern int          Zygotes;
+
+
+/*
+ * Container lifecycle (ns.c)
+ */
+
+// Clone a kid in namespaces 'flags' and cgroup 'cg' (if not null);
+// it waits until released. Returns its pid, the parent's end of
+// the socketpair in 'fdp' and a pidfd for it in 'pidfdp'.
+extern pid_t spawn_child(int flags, cgroup *cg, int *fdp, int *pidfdp);
+
+// Release the kid waiting on 'fd' to pivot to 'rootfs' and exec
+// 'init'. With --lower, 'rootfs' is where the overlay is mounted
+// and 'upper' (if not null) holds its upper and work dirs. Returns
+// 0 or -errno (e.g., if the kid died).
+extern int   release_child(int fd, const char *rootfs, const char *init, const char *upper);
+
+// Send the kid waiting on 'fd' an idmapped clone of 'rootfs' for
+// its user namespace; do this just before release_child().
+// Returns 0 or -errno.
+extern int   send_idmap(int fd, pid_t kid, const char *rootfs);
+
+// Attach --image to a loop device; kids cloned after this mount it
+// read-only as their rootfs. Returns the loop device's fd; close it
+// once no more kids will mount it. Dies on failure.
+extern int   attach_image(void);
+
+// Name the prefetch manifest of 'rootfs' (or of the --image or
+// topmost --lower dir)
+extern void  prefetch_path(char *buf, size_t n, const char *rootfs);
+
+// Start reading ahead the manifest of 'rootfs' in the background;
+// a missing manifest is not an error.
+extern void  start_prefetch(const char *rootfs);
+
+// Make the upper and work dirs of an overlay under 'dir', owned by
+// 'uid'/'gid' with --user. Returns 0 or -errno.
+extern int   make_upper(const char *dir, int uid, int gid);
+
+// Map uid/gid 0 in the kid's user namespace to 'uid'/'gid'
+extern void  map_ids(pid_t kid, int uid, int gid);
+
+// Make cgroup 'name' with the configured resource limits; returns
+// 1, 0 if no limits (or telemetry) are configured and 'cg' is
+// unused, or -errno (reported; the cgroup is removed).
+extern int   setup_cgroup(cgroup *cg, const char *name);
+
+// True if the cgroup of a container is to be watched for OOM kills
+// (see oom.h)
+extern int   watch_oom(void);
+
+// Set the I/O priority (--io-prio) of 'kid'; its descendants
+// inherit it.
+extern void  set_ioprio(pid_t kid);
+
+// Run the pre-exec script for 'kid' with a timeout of Pretimeout;
+// returns 0 on success and -1 on failure.
+extern int   run_exe(char *const exe, pid_t kid, const char *pooled);
+
+// Call the --hook for 'kid' (pooled: as for run_exe()); returns 0
+// or NS_HOOK_SCRIPT on success and -1 on failure.
+extern int   run_hook(pid_t kid, const char *rootfs, const char *init, const char *pooled, int uid, int gid);
+
+// Start the pre-exec script for 'kid' in its own process group;
+// returns a pidfd for it and its pid in 'pidp' or -errno.
+extern int   start_exe(char *const exe, pid_t kid, const char *pooled, pid_t *pidp);
+
+// Kill a script started by start_exe() and its process group
+extern void  kill_exe(int pidfd, pid_t pid);
+
+// Return 0 if 'exe' exited cleanly with wait status 'st'; warn and
+// return -1 otherwise.
+extern int   exe_status(const char *exe, int st);
+
+// Die unless 'exe' under 'root' is an executable file; check_exe()
+// instead returns -1 with the reason in 'err'.
+extern void  validate_exe(const char *root, const char *exe);
+extern int   check_exe(const char *root, const char *exe, char *err, size_t n);
+
+// check_exe() for the container's init: with --lower, 'init' is
+// looked up in the lower dirs and 'rootfs' need only be a dir.
+extern int   check_init(const char *rootfs, const char *init, char *err, size_t n);
+extern int   parse_uidgid(const char *str);
+extern int   check_unpriv_userns(int euid);
+extern void  progress(const char *fmt, ...);
+
+
+/*
+ * Pre-forked container pool (zygote.c)
+ */
+
+// Set the namespaces and uid/gid maps of the kids in the pool;
+// watch() (if not null) is called with each new parked kid.
+extern void  zygote_init(int flags, int uid, int gid, void (*watch)(pid_t pid, int pidfd));
+
+// Top up the pool to 'Zygotes' parked kids
+extern void  zygote_fill(void);
+
+// Take a parked kid (or clone one if the pool is empty); returns
+// its pid, the parent's end of its socketpair in 'fdp' and its
+// pidfd in 'pidfdp'
+extern pid_t zygote_take(int *fdp, int *pidfdp);
+
+// Forget parked kid 'pid' after it died and close its fds; returns
+// true if it was in the pool
+extern int   zygote_forget(pid_t pid);
+
+// Kill all parked kids
+extern void  zygote_kill(void);
+
+
+/*
+ * Container supervisor daemon (nsd.c)
+ */
+
+// Run the daemon: argv is "SOCKET [uid gid]"
+extern int   nsd_main(int argc, char * const argv[]);
+
+// Send request 'verb' with 'argc' arguments to the daemon listening
+// on 'sock' and print its reply.
+extern int   nsd_request(const char *sock, const char *verb, int argc, char * const argv[]);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* ! ___NS_H__Vt6oS9eJx2MbQ4Rn___ */
+
+/* EOF */
@@ -0,0 +1,1153 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * nsd.c - container supervisor daemon.
+ *
+ * One daemon process launches and supervises many containers.
+ * Containers are released from the pre-forked pool in zygote.c.
+ * Its options (--network, --user, --memory, ..) apply to every
+ * container it launches.
+ *
+ * The daemon is a single epoll loop over the control socket, a
+ * signalfd for SIGTERM/SIGINT and a pidfd for every process it
+ * owns: parked kids, containers and running pre-exec scripts. A
+ * launch whose pre-exec script is running waits in the 'starting'
+ * state without blocking other requests; the script is killed after
+ * --pre-timeout. A --hook is called in the loop itself. Signals go
+ * through pidfds, so they can't hit a recycled pid.
+ *
+ * Requests and replies are SOCK_SEQPACKET messages on a unix
+ * socket; one request per connection:
+ *
+ *   "launch\0PRE\0ROOTFS\0INIT\0"  -> "ok PID"
+ *   "launch\0PRE\0ROOTFS\0INIT\0PRIO:MIN:MAX\0" (--memory-budget)
+ *   "stop\0PID\0"                   -> "ok PID"
+ *   "status\0"                      -> "ok N" followed by N messages
+ *                                      "PID STATE UPTIME ROOTFS INIT"
+ *
+ * Any request can instead get "error MESSAGE". 'stop' sends SIGTERM
+ * and SIGKILL after NSD_GRACE_MS if the container is still around;
+ * a container init that has no SIGTERM handler only goes away with
+ * the latter.
+ *
+ * 'ns freeze' and 'ns thaw' go straight to the cgroup of a
+ * container; its STATE is "frozen" while it is. A frozen container
+ * is thawed before it is signalled -- a v1 freezer holds back even
+ * SIGKILL.
+ *
+ * With --restart, a running container that is OOM killed is
+ * launched again from its request after a backoff (see oom.h); it
+ * gets a new pid.
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "error.h"
+#include "trace.h"
+#include "pidfd.h"
+#include "hook.h"
+#include "stats.h"
+#include "adapt.h"
+#include "arbiter.h"
+#include "idle.h"
+#include "oom.h"
+#include "ns.h"
+
+#define CONTAINER_MAX   1024
+#define NSD_GRACE_MS    5000
+
+// Container states
+#define STARTING    0   // pre-exec script is running
+#define RUNNING     1
+#define STOPPING    2   // signalled; waiting for it to exit
+
+static const char *Statename[] = { "starting", "running", "stopping" };
+
+struct container
+{
+    pid_t    pid;
+    int      pidfd;
+    int      state;
+    uint64_t start;     // now_ms() at launch
+    uint64_t deadline;  // pre-exec timeout or SIGKILL; 0 if none
+    char    *rootfs;
+    char    *init;
+    char    *upper;     // overlay upper/work parent (--upper)
+    cgroup   cg;
+    int      limited;   // true if 'cg' is in use
+    stats    st;        // --stats-interval
+    adapt    ad;        // --memory-adapt
+    share    sh;        // --memory-budget
+    idle     idl;       // --idle-reclaim
+    oom      oom;       // see watch_oom()
+    char    *spec;      // share of the launch; 0 if none
+    char    *pre;       // pre-exec script of the launch
+
+    // Of its last --restart; 0 if none
+    int      restart;
+    int      backoff;   // ms
+    uint64_t died;      // now_ms() at the death before it
+
+    // Only while starting
+    int      fd;        // parent's end of the kid's socketpair
+    int      client;    // connection to reply to
+    pid_t    prepid;
+    int      prefd;     // pidfd of the pre-exec script
+    struct trace *tr;   // --trace events while the script runs
+};
+typedef struct container container;
+
+static container Ct[CONTAINER_MAX];
+static int       Nct = 0;
+
+/*
+ * A launch request; one that is queued for --restart also has the
+ * details of the restart.
+ */
+struct request
+{
+    char    *pre, *rootfs, *init;
+    char    *spec;      // 0 if none
+    int      restart;   // 1 is the first; 0 if none
+    int      backoff;   // ms
+    uint64_t died;      // now_ms() at the death before it
+    uint64_t due;       // now_ms() to launch it
+};
+typedef struct request request;
+
+static request Rq[CONTAINER_MAX];
+static int     Nrq = 0;
+
+/*
+ * epoll data is the kind of fd, the fd and the pid it belongs to.
+ *
+ * Parked kids (and pre-exec scripts before their exec) hold copies
+ * of our pidfds; an epoll registration lives as long as the file
+ * does, not our fd. So every pidfd is explicitly removed from the
+ * epoll set before it is closed -- see unwatch().
+ */
+#define EV_LISTEN       1
+#define EV_SIGNAL       2
+#define EV_PARKED       3
+#define EV_CONTAINER    4
+#define EV_PRE          5
+#define EV_STATS        6
+#define EV_PRESSURE     7   // PSI trigger of --memory-adapt
+#define EV_ADAPT        8
+#define EV_ARBITER      9
+#define EV_IDLE         10
+#define EV_OOM          11  // memory.events or oom_control eventfd
+#define EV_CLIENT       12  // a connection whose request is not in yet
+
+#define EV_TAG(kind, fd, pid) \
+    (((uint64_t)(kind) << 56) | ((uint64_t)((fd) & 0xffffff) << 32) | (uint32_t)(pid))
+
+#define EV_KIND(u)  ((int)((u) >> 56))
+#define EV_FD(u)    ((int)(((u) >> 32) & 0xffffff))
+#define EV_PID(u)   ((pid_t)(uint32_t)(u))
+
+static int Epfd = -1;
+static int Uid, Gid;
+
+
+static uint64_t
+now_ms(void)
+{
+    return trace_now() / 1000000;
+}
+
+
+static void
+ev_ctl(int op, int fd, int kind, pid_t pid)
+{
+    // PSI triggers and (v2) memory.events signal with POLLPRI
+    int pri = kind == EV_PRESSURE || (kind == EV_OOM && cgroup_version() == CGROUP_V2);
+    struct epoll_event ev = { .events = pri ? EPOLLPRI : EPOLLIN,
+                              .data.u64 = EV_TAG(kind, fd, pid) };
+
+    if (epoll_ctl(Epfd, op, fd, &ev) < 0) error(1, errno, "nsd: can't watch fd %d", fd);
+}
+
+
+// A periodic timerfd in the epoll set
+static void
+ticker(int ms, int kind)
+{
+    struct itimerspec it;
+    int fd;
+
+    it.it_interval.tv_sec  = ms / 1000;
+    it.it_interval.tv_nsec = (ms % 1000) * 1000000L;
+    it.it_value            = it.it_interval;
+
+    if ((fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC|TFD_NONBLOCK)) < 0)
+        error(1, errno, "can't create timerfd");
+    if (timerfd_settime(fd, 0, &it, 0) < 0) error(1, errno, "can't arm timerfd");
+    ev_ctl(EPOLL_CTL_ADD, fd, kind, 0);
+}
+
+
+// Stop watching a pidfd whose process exited
+static void
+unwatch(int fd)
+{
+    if (epoll_ctl(Epfd, EPOLL_CTL_DEL, fd, 0) < 0 && errno != ENOENT)
+        error(0, errno, "nsd: can't unwatch fd %d", fd);
+}
+
+
+// Called by the pool for every new parked kid
+static void
+watch_parked(pid_t pid, int pidfd)
+{
+    ev_ctl(EPOLL_CTL_ADD, pidfd, EV_PARKED, pid);
+}
+
+
+static container *
+find(pid_t pid)
+{
+    int i;
+
+    for (i = 0; i < Nct; i++) {
+        if (Ct[i].pid == pid) return &Ct[i];
+    }
+    return 0;
+}
+
+
+static container *
+find_pre(pid_t pid)
+{
+    int i;
+
+    for (i = 0; i < Nct; i++) {
+        if (Ct[i].prefd >= 0 && Ct[i].prepid == pid) return &Ct[i];
+    }
+    return 0;
+}
+
+
+static int
+starting(void)
+{
+    int i;
+
+    for (i = 0; i < Nct; i++) {
+        if (Ct[i].state == STARTING) return 1;
+    }
+    return 0;
+}
+
+
+/*
+ * Reply to a pending request and close its connection.
+ */
+static void
+reply(container *c, const char *fmt, ...)
+{
+    char buf[PATH_MAX+128];
+    va_list ap;
+
+    if (c->client < 0) return;
+
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof buf, fmt, ap);
+    va_end(ap);
+
+    if (n >= (int)sizeof buf) n = sizeof buf - 1;
+    if (send(c->client, buf, n, MSG_NOSIGNAL) < 0) error(0, errno, "nsd: can't reply");
+
+    close(c->client);
+    c->client = -1;
+}
+
+
+static void
+signal_container(container *c, int sig)
+{
+    int r;
+
+    if (c->limited && cgroup_frozen(c->cg.name) > 0 &&
+        (r = cgroup_freeze(c->cg.name, 0, NSD_GRACE_MS)) < 0)
+        error(0, -r, "nsd: can't thaw container %d", c->pid);
+
+    r = pidfd_kill(c->pidfd, sig);
+
+    if (r < 0 && r != -ESRCH) error(0, -r, "nsd: can't signal container %d", c->pid);
+}
+
+
+/*
+ * Fail a launch: reply with the error and kill the kid (and the
+ * pre-exec script). The container stays in the table until its
+ * exit is reaped; so its cgroup can be removed.
+ */
+static void
+fail(container *c, const char *msg)
+{
+    if (c->client < 0) error(0, 0, "nsd: can't restart container %d: %s", c->pid, msg);
+    reply(c, "error %s", msg);
+
+    if (c->prefd >= 0) kill_exe(c->prefd, c->prepid);
+    signal_container(c, SIGKILL);
+
+    c->state    = STOPPING;
+    c->deadline = 0;
+}
+
+
+/*
+ * Split --memory-budget between the containers we have.
+ */
+static void
+rebalance(void)
+{
+    share *v[CONTAINER_MAX];
+    int i, n = 0;
+
+    if (!Membudget) return;
+
+    for (i = 0; i < Nct; i++) {
+        if (Ct[i].sh.cur >= 0) v[n++] = &Ct[i].sh;
+    }
+    arbiter_split(v, n, Membudget);
+}
+
+
+static void
+forget(container *c)
+{
+    reply(c, "error container %d died during launch", c->pid);
+
+    if (c->fd >= 0)    close(c->fd);
+    if (c->prefd >= 0) {
+        // The kid is gone; so is any reason to run its script.
+        kill_exe(c->prefd, c->prepid);
+        waitpid(c->prepid, 0, 0);
+        unwatch(c->prefd);
+        close(c->prefd);
+    }
+    close(c->pidfd);
+
+    stats_close(&c->st);
+    if (Adaptmax) {
+        if (c->ad.trig >= 0) unwatch(c->ad.trig);
+        adapt_close(&c->ad);
+    }
+    if (Membudget) share_close(&c->sh);
+    if (Idlereclaim) idle_close(&c->idl);
+    if (c->oom.fd >= 0) {
+        unwatch(c->oom.fd);
+        oom_close(&c->oom);
+    }
+    if (c->limited) cgroup_destroy(&c->cg);
+    free(c->rootfs);
+    free(c->init);
+    free(c->upper);
+    free(c->pre);
+    free(c->spec);
+    free(c->tr);
+    *c = Ct[--Nct];
+
+    // Its share goes to the others
+    rebalance();
+}
+
+
+/*
+ * Release a kid whose per-container setup is done.
+ */
+static void
+finish(container *c)
+{
+    int r;
+
+    if (Idmap && (r = send_idmap(c->fd, c->pid, c->rootfs)) < 0) {
+        fail(c, "can't send the kid its idmapped rootfs");
+        return;
+    }
+
+    trace_mark("release");
+
+    r = release_child(c->fd, c->rootfs, c->init, c->upper);
+    if (r < 0) {
+        fail(c, "can't release kid");
+        return;
+    }
+
+    if (Tracefile) {
+        r = trace_recv(c->fd);
+        if (r < 0) error(0, r, "can't receive trace from kid %d", c->pid);
+
+        trace_write(Tracefile, c->pid);
+    }
+    close(c->fd);
+    c->fd       = -1;
+    c->state    = RUNNING;
+    c->deadline = 0;
+
+    progress("nsd: launched %s in %s as %d\n", c->init, c->rootfs, c->pid);
+    reply(c, "ok %d", c->pid);
+
+    if (c->restart) {
+        uint64_t down = now_ms() - c->died;
+
+        stats_event(c->pid, "restart",
+                    "\"restart\":%d,\"max\":%d,\"backoff_ms\":%d,\"down_ms\":%llu,\"start_ms\":%llu",
+                    c->restart, Restarts, c->backoff, (unsigned long long)down,
+                    (unsigned long long)(down - c->backoff));
+    }
+}
+
+
+/*
+ * Queue a launch of container 'c' again if it was OOM killed while
+ * running and it has --restart left; its strings go to the queue.
+ */
+static void
+requeue(container *c, int st)
+{
+    if (c->oom.fd < 0 || c->state != RUNNING || st == 0) return;
+
+    // The last counts can come in after the kid is gone
+    oom_event(&c->oom);
+    if (c->oom.oom + c->oom.kill == 0 || c->restart >= Restarts) return;
+    if (Nrq == CONTAINER_MAX) {
+        warn("too many restarts queued; container %d is not restarted", c->pid);
+        return;
+    }
+
+    request *r = &Rq[Nrq++];
+
+    r->pre     = c->pre;
+    r->rootfs  = c->rootfs;
+    r->init    = c->init;
+    r->spec    = c->spec;
+    r->restart = c->restart + 1;
+    r->backoff = oom_backoff(c->restart);
+    r->died    = now_ms();
+    r->due     = r->died + r->backoff;
+
+    c->pre = c->rootfs = c->init = c->spec = 0;
+
+    progress("nsd: container %d was OOM killed; restart %d of %d in %d ms ..\n",
+             c->pid, r->restart, Restarts, r->backoff);
+}
+
+
+/*
+ * A process we watch exited.
+ */
+static void
+reap(int kind, pid_t pid)
+{
+    container *c = 0;
+    int st = 0;
+
+    if (kind == EV_PRE) {
+        if (!(c = find_pre(pid))) return;
+
+        waitpid(pid, &st, 0);
+        close(c->prefd);
+        c->prefd = -1;
+
+        // The launch failed already
+        if (c->state != STARTING) return;
+
+        if (exe_status(c->pre, st) < 0) {
+            fail(c, "pre-exec script failed");
+            return;
+        }
+
+        trace_load(c->tr);
+        c->tr = 0;
+        trace_mark("preexec");
+        finish(c);
+        return;
+    }
+
+    if (waitpid(pid, &st, 0) < 0) return;
+
+    // A kid can be taken from the pool after its exit was queued
+    if (!zygote_forget(pid) && (c = find(pid))) {
+        requeue(c, st);
+        forget(c);
+    }
+
+    if (WIFEXITED(st))
+        progress("nsd: %s %d exited with code %d\n",
+                 c ? "container" : "parked kid", pid, WEXITSTATUS(st));
+    else if (WIFSIGNALED(st))
+        progress("nsd: %s %d caught signal %d\n",
+                 c ? "container" : "parked kid", pid, WTERMSIG(st));
+}
+
+
+/*
+ * A periodic timer of 'kind' expired: sample, adapt, rebalance or
+ * look for idle containers.
+ */
+static void
+tick(int kind, int tfd)
+{
+    uint64_t ticks;
+    int i;
+
+    if (read(tfd, &ticks, sizeof ticks) != sizeof ticks) return;
+
+    if (kind == EV_ARBITER) {
+        rebalance();
+        return;
+    }
+
+    for (i = 0; i < Nct; i++) {
+        container *c = &Ct[i];
+
+        if (c->state != RUNNING) continue;
+
+        if      (kind == EV_STATS) stats_sample(&c->st);
+        else if (kind == EV_ADAPT) adapt_tick(&c->ad);
+        else if (kind == EV_IDLE)  idle_tick(&c->idl, Idlereclaim);
+    }
+}
+
+
+/*
+ * Act on expired deadlines; return the epoll timeout until the
+ * next one (-1 if none).
+ */
+static int
+timeouts(void)
+{
+    uint64_t now  = now_ms();
+    uint64_t next = 0;
+    int i;
+
+    for (i = 0; i < Nct; i++) {
+        container *c = &Ct[i];
+
+        if (c->deadline == 0) continue;
+        if (c->deadline <= now) {
+            if (c->state == STARTING) {
+                warn("%s is still running after %d ms; killing it", c->pre, Pretimeout);
+                kill_exe(c->prefd, c->prepid);
+                c->deadline = 0;
+                continue;
+            }
+
+            progress("nsd: container %d ignored SIGTERM; killing ..\n", c->pid);
+            signal_container(c, SIGKILL);
+            c->deadline = now + NSD_GRACE_MS;
+        }
+        if (next == 0 || c->deadline < next) next = c->deadline;
+    }
+    return next ? (int)(next - now) : -1;
+}
+
+
+/*
+ * Parse the "PRIO:MIN:MAX" share of a launch ('spec' is 0 if none)
+ * into 's' and check that its MIN fits into what the MINs of the
+ * other containers left of --memory-budget. Returns the reply
+ * length of an error or 0.
+ */
+static size_t
+admit(share *s, const char *spec, char *reply, size_t n)
+{
+    unsigned long long min = 0, max = 0;
+    uint64_t cap  = Memlimit && Memlimit < Membudget ? Memlimit : Membudget;
+    uint64_t used = 0;
+    int prio = ARBITER_PRIO, i;
+
+    if (!Membudget) {
+        if (spec) return snprintf(reply, n, "error no --memory-budget to share");
+        return 0;
+    }
+
+    if (spec && 3 != sscanf(spec, "%d:%llu:%llu", &prio, &min, &max))
+        return snprintf(reply, n, "error malformed share %s", spec);
+
+    if (max == 0 || max > cap) max = cap;
+    if (min > max)             min = max;
+
+    for (i = 0; i < Nct; i++) used += Ct[i].sh.min;
+    if (used + min > Membudget)
+        return snprintf(reply, n, "error memory budget exhausted (%llu of %llu bytes reserved)",
+                        (unsigned long long)used, (unsigned long long)Membudget);
+
+    s->prio = prio;
+    s->min  = min;
+    s->max  = max;
+    return 0;
+}
+
+
+/*
+ * Start a launch; returns the reply length for an immediate reply
+ * or 0 if the launch now owns 'client' (-1 for a restart).
+ */
+static size_t
+launch(int client, const request *q, char *reply, size_t n)
+{
+    char *pre    = q->pre;
+    char *rootfs = q->rootfs;
+    char *init   = q->init;
+    char err[PATH_MAX+64];
+    share sh = { .prio = 0 };
+    size_t m;
+    int  fd, pidfd, r;
+
+    trace_reset();
+    trace_mark("request");
+
+    if (Nct == CONTAINER_MAX)
+        return snprintf(reply, n, "error too many containers (max %d)", CONTAINER_MAX);
+
+    if (strcmp(pre, "-") != 0 && check_exe("/", pre, err, sizeof err) < 0)
+        return snprintf(reply, n, "error %s", err);
+    if (check_init(rootfs, init, err, sizeof err) < 0)
+        return snprintf(reply, n, "error %s", err);
+    if ((m = admit(&sh, q->spec, reply, n)) > 0)
+        return m;
+
+    if (Prefetch) {
+        start_prefetch(rootfs);
+        trace_mark("prefetch");
+    }
+
+    pid_t kid = zygote_take(&fd, &pidfd);
+    trace_mark("unpark");
+
+    container *c = &Ct[Nct++];
+
+    memset(c, 0, sizeof *c);
+    c->pid    = kid;
+    c->pidfd  = pidfd;
+    c->state  = STARTING;
+    c->start  = now_ms();
+    c->rootfs = strdup(rootfs);
+    c->init   = strdup(init);
+    c->pre    = strdup(pre);
+    c->spec   = q->spec ? strdup(q->spec) : 0;
+    c->fd     = fd;
+    c->client = client;
+    c->prefd  = -1;
+    c->ad.trig = c->ad.high = c->ad.cur = -1;
+    c->sh.cur = c->sh.highfd = -1;
+    c->idl.cpu = c->idl.cur = c->idl.rec = -1;
+    c->oom.fd = c->oom.ctl = -1;
+    c->restart = q->restart;
+    c->backoff = q->backoff;
+    c->died    = q->died;
+
+    ev_ctl(EPOLL_CTL_MOD, pidfd, EV_CONTAINER, kid);
+
+    set_ioprio(kid);
+
+    /*
+     * Parked kids were cloned before the request; so they are
+     * moved into their cgroup rather than cloned into it.
+     */
+    char cgname[32];
+
+    snprintf(cgname, sizeof cgname, "%d", kid);
+    if ((r = setup_cgroup(&c->cg, cgname)) < 0) {
+        snprintf(err, sizeof err, "can't set up cgroup %s: %s", cgname, strerror(-r));
+        fail(c, err);
+        return 0;
+    }
+    c->limited = r;
+    if (c->limited && Statsinterval) {
+        stats_open(&c->st, &c->cg);
+        c->st.pid = kid;
+    }
+    if (Adaptmax) {
+        if ((r = adapt_open(&c->ad, &c->cg, Adaptmin, Adaptmax)) < 0) {
+            snprintf(err, sizeof err, "can't set up --memory-adapt: %s", strerror(-r));
+            fail(c, err);
+            return 0;
+        }
+        c->ad.pid = kid;
+        ev_ctl(EPOLL_CTL_ADD, c->ad.trig, EV_PRESSURE, kid);
+    }
+    if (Membudget) {
+        if ((r = share_open(&c->sh, &c->cg, sh.prio, sh.min, sh.max)) < 0) {
+            snprintf(err, sizeof err, "can't set up memory share: %s", strerror(-r));
+            fail(c, err);
+            return 0;
+        }
+        c->sh.pid = kid;
+        rebalance();
+    }
+    if (Idlereclaim) {
+        if ((r = idle_open(&c->idl, &c->cg)) < 0) {
+            snprintf(err, sizeof err, "can't set up --idle-reclaim: %s", strerror(-r));
+            fail(c, err);
+            return 0;
+        }
+        c->idl.pid = kid;
+    }
+    if (c->limited && watch_oom()) {
+        if ((r = oom_open(&c->oom, &c->cg)) < 0) {
+            snprintf(err, sizeof err, "can't watch for OOM kills: %s", strerror(-r));
+            fail(c, err);
+            return 0;
+        }
+        c->oom.pid = kid;
+        ev_ctl(EPOLL_CTL_ADD, c->oom.fd, EV_OOM, kid);
+    }
+    if (c->limited) {
+        if ((r = cgroup_attach(&c->cg, kid)) < 0) {
+            snprintf(err, sizeof err, "can't move %d to its cgroup: %s", kid, strerror(-r));
+            fail(c, err);
+            return 0;
+        }
+        trace_mark("cgroup");
+    }
+
+    // Each container gets its own upper; they are left behind.
+    if (Upper) {
+        char upper[PATH_MAX];
+
+        snprintf(upper, sizeof upper, "%s/%d", Upper, kid);
+        if ((r = make_upper(upper, Uid, Gid)) < 0) {
+            snprintf(err, sizeof err, "can't make overlay dirs in %s: %s", upper, strerror(-r));
+            fail(c, err);
+            return 0;
+        }
+        c->upper = strdup(upper);
+    }
+
+    int script = strcmp(pre, "-") != 0;
+
+    // In-process; it blocks the loop while it runs.
+    if (Hook) {
+        if ((r = run_hook(kid, rootfs, init, 0, Uid, Gid)) < 0) {
+            fail(c, "pre-exec hook failed");
+            return 0;
+        }
+        trace_mark("hook");
+        script = script && r == NS_HOOK_SCRIPT;
+    }
+
+    if (!script) {
+        finish(c);
+        return 0;
+    }
+
+    c->prefd    = start_exe(pre, kid, 0, &c->prepid);
+    if (c->prefd < 0) {
+        snprintf(err, sizeof err, "can't start %s: %s", pre, strerror(-c->prefd));
+        c->prefd = -1;
+        fail(c, err);
+        return 0;
+    }
+    c->deadline = Pretimeout > 0 ? now_ms() + Pretimeout : 0;
+    ev_ctl(EPOLL_CTL_ADD, c->prefd, EV_PRE, c->prepid);
+
+    // Other launches are traced while the script runs
+    if (Tracefile) c->tr = trace_save();
+    return 0;
+}
+
+
+/*
+ * Launch the queued restarts that are due; return the epoll
+ * timeout until the next one (-1 if none).
+ */
+static int
+relaunch(void)
+{
+    char reply[PATH_MAX+128];
+    uint64_t now  = now_ms();
+    uint64_t next = 0;
+    int i;
+
+    for (i = 0; i < Nrq; i++) {
+        request *r = &Rq[i];
+
+        if (r->due > now) {
+            if (next == 0 || r->due < next) next = r->due;
+            continue;
+        }
+
+        if (launch(-1, r, reply, sizeof reply) > 0)
+            error(0, 0, "nsd: can't restart %s in %s: %s", r->init, r->rootfs, reply);
+
+        free(r->pre);
+        free(r->rootfs);
+        free(r->init);
+        free(r->spec);
+        Rq[i--] = Rq[--Nrq];
+    }
+    return next ? (int)(next - now) : -1;
+}
+
+
+static size_t
+stop(char *pid, char *reply, size_t n)
+{
+    char *end = 0;
+    long p    = strtol(pid, &end, 10);
+    container *c;
+
+    if (!end || *end || p <= 0 || !(c = find(p)))
+        return snprintf(reply, n, "error no container %s", pid);
+
+    if (c->state == STARTING) {
+        fail(c, "container was stopped during launch");
+    } else if (c->state == RUNNING) {
+        signal_container(c, SIGTERM);
+        c->state    = STOPPING;
+        c->deadline = now_ms() + NSD_GRACE_MS;
+        progress("nsd: stopping container %d ..\n", c->pid);
+    }
+    return snprintf(reply, n, "ok %d", c->pid);
+}
+
+
+/*
+ * One message per container after the "ok N" header; a single reply
+ * for hundreds of containers could exceed the socket buffer.
+ */
+static void
+status(int fd)
+{
+    char buf[2 * PATH_MAX + 64];
+    uint64_t now = now_ms();
+    int i, m;
+
+    m = snprintf(buf, sizeof buf, "ok %d", Nct);
+    if (send(fd, buf, m, MSG_NOSIGNAL) < 0) goto fail;
+
+    for (i = 0; i < Nct; i++) {
+        container *c = &Ct[i];
+
+        int frozen = c->limited && cgroup_frozen(c->cg.name) > 0;
+
+        m = snprintf(buf, sizeof buf, "%d %s %llu %s %s", c->pid,
+                     frozen ? "frozen" : Statename[c->state],
+                     (unsigned long long)(now - c->start) / 1000,
+                     c->rootfs, c->init);
+        if (m >= (int)sizeof buf) m = sizeof buf - 1;
+        if (send(fd, buf, m, MSG_NOSIGNAL) < 0) goto fail;
+    }
+    return;
+
+fail:
+    error(0, errno, "nsd: can't send status");
+}
+
+
+/*
+ * Split a request into at most 'max' nul terminated fields.
+ */
+static int
+split(char *buf, size_t n, char **f, int max)
+{
+    char *e = buf + n;
+    int   k = 0;
+
+    while (buf < e && k < max) {
+        f[k++] = buf;
+        buf   += strlen(buf) + 1;
+    }
+    return k;
+}
+
+
+/*
+ * Serve one request on connection 'c' once it is readable; close it
+ * unless a launch in progress now owns it.
+ */
+static void
+serve(int c)
+{
+    char buf[3 * PATH_MAX + 128];
+    char reply[PATH_MAX+128];
+    char *f[5];
+    size_t m = 0;
+
+    ssize_t n = read(c, buf, sizeof buf - 1);
+    if (n <= 0) goto done;
+
+    // Replies block as before; the client waits for them.
+    if (fcntl(c, F_SETFL, 0) < 0) goto done;
+
+    buf[n] = 0;
+    int k = split(buf, n, f, 5);
+
+    if ((k == 4 || k == 5) && 0 == strcmp(f[0], "launch")) {
+        request q = { .pre = f[1], .rootfs = f[2], .init = f[3], .spec = k == 5 ? f[4] : 0 };
+
+        if (!(m = launch(c, &q, reply, sizeof reply))) return;
+    } else if (k == 2 && 0 == strcmp(f[0], "stop")) {
+        m = stop(f[1], reply, sizeof reply);
+    } else if (k == 1 && 0 == strcmp(f[0], "status")) {
+        status(c);
+        goto done;
+    } else {
+        m = snprintf(reply, sizeof reply, "error malformed request");
+    }
+
+    if (m >= sizeof reply) m = sizeof reply - 1;
+    if (send(c, reply, m, MSG_NOSIGNAL) < 0) error(0, errno, "nsd: can't reply");
+
+done:
+    close(c);
+}
+
+
+static void
+sockaddr_of(struct sockaddr_un *sa, const char *path)
+{
+    memset(sa, 0, sizeof *sa);
+    sa->sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof sa->sun_path) die("socket path %s is too long", path);
+    strcpy(sa->sun_path, path);
+}
+
+
+static int
+listen_on(const char *path)
+{
+    struct sockaddr_un sa;
+    int fd;
+
+    sockaddr_of(&sa, path);
+    if ((fd = socket(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0)) < 0) error(1, errno, "can't create socket");
+
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&sa, sizeof sa) < 0) error(1, errno, "can't bind to %s", path);
+    if (listen(fd, 64) < 0) error(1, errno, "can't listen on %s", path);
+    return fd;
+}
+
+
+int
+nsd_main(int argc, char * const argv[])
+{
+    const char *sock = argv[0];
+    int flags = CLONE_NEWNS | CLONE_NEWPID | CLONE_NEWUTS;
+    sigset_t mask;
+    int i;
+
+    if (Veth || Netpool) die("--veth and --netns-pool are not supported by the daemon");
+    if (Record)          die("--record-prefetch is not supported by the daemon");
+
+    if (Netns) flags |= CLONE_NEWNET;
+
+    if (Userns) {
+        if (argc < 3) die("daemon: --user needs uid and gid");
+
+        Uid = parse_uidgid(argv[1]);
+        Gid = parse_uidgid(argv[2]);
+
+        int euid = geteuid();
+        if (euid != 0) check_unpriv_userns(euid);
+
+        flags |= CLONE_NEWUSER;
+    }
+
+    if ((Epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) error(1, errno, "can't create epoll fd");
+
+    zygote_init(flags, Uid, Gid, watch_parked);
+
+    // One loop device for all containers; they share its page cache.
+    if (Image) attach_image();
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    if (sigprocmask(SIG_BLOCK, &mask, 0) < 0) error(1, errno, "can't block signals");
+
+    int sfd = signalfd(-1, &mask, SFD_CLOEXEC|SFD_NONBLOCK);
+    if (sfd < 0) error(1, errno, "can't create signalfd");
+
+    int lfd = listen_on(sock);
+
+    ev_ctl(EPOLL_CTL_ADD, sfd, EV_SIGNAL, 0);
+    ev_ctl(EPOLL_CTL_ADD, lfd, EV_LISTEN, 0);
+
+    if (Statsinterval) ticker(Statsinterval, EV_STATS);
+    if (Adaptmax)      ticker(ADAPT_TICK_MS, EV_ADAPT);
+    if (Membudget)     ticker(ARBITER_TICK_MS, EV_ARBITER);
+    if (Idlereclaim)   ticker(IDLE_TICK_MS, EV_IDLE);
+
+    zygote_fill();
+
+    progress("nsd: listening on %s with %d parked kids ..\n", sock, Zygotes);
+
+    for (;;) {
+        struct epoll_event ev[64];
+        int quit = 0;
+
+        int ms = timeouts();
+        int rs = relaunch();
+
+        if (rs >= 0 && (ms < 0 || rs < ms)) ms = rs;
+
+        int n = epoll_wait(Epfd, ev, 64, ms);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            error(1, errno, "nsd: epoll_wait failed");
+        }
+
+        for (i = 0; i < n; i++) {
+            uint64_t u = ev[i].data.u64;
+            int kind   = EV_KIND(u);
+
+            switch (kind) {
+                case EV_SIGNAL: {
+                    struct signalfd_siginfo si;
+
+                    while (read(sfd, &si, sizeof si) == sizeof si) quit = 1;
+                    break;
+                }
+
+                case EV_LISTEN: {
+                    // A client that connects and sends nothing must
+                    // not hold up the loop; its request is read when
+                    // it comes in.
+                    int c = accept4(lfd, 0, 0, SOCK_CLOEXEC|SOCK_NONBLOCK);
+                    if (c < 0) {
+                        error(0, errno, "nsd: accept failed");
+                        break;
+                    }
+                    ev_ctl(EPOLL_CTL_ADD, c, EV_CLIENT, 0);
+                    break;
+                }
+
+                case EV_CLIENT:
+                    unwatch(EV_FD(u));
+                    serve(EV_FD(u));
+                    break;
+
+                case EV_STATS:
+                case EV_ADAPT:
+                case EV_ARBITER:
+                case EV_IDLE:
+                    tick(kind, EV_FD(u));
+                    break;
+
+                case EV_PRESSURE: {
+                    container *c = find(EV_PID(u));
+
+                    if (c && c->state == RUNNING) adapt_pressure(&c->ad);
+                    break;
+                }
+
+                case EV_OOM: {
+                    container *c = find(EV_PID(u));
+
+                    if (!c || oom_event(&c->oom) == 0 || c->oom.group) break;
+
+                    progress("nsd: container %d ran out of memory; killing it ..\n", c->pid);
+                    if (c->state == STARTING) fail(c, "container ran out of memory during launch");
+                    else                      signal_container(c, SIGKILL);
+                    break;
+                }
+
+                default:
+                    unwatch(EV_FD(u));
+                    reap(kind, EV_PID(u));
+                    break;
+            }
+        }
+        if (quit) break;
+
+        // Cloning is slow; don't hold up launches in progress.
+        if (!starting()) zygote_fill();
+    }
+
+    // Containers die with their pid-1; parked kids are just
+    // killed.
+    progress("nsd: shutting down %d containers ..\n", Nct);
+    zygote_kill();
+    for (i = 0; i < Nct; i++) {
+        if (Ct[i].prefd >= 0) kill_exe(Ct[i].prefd, Ct[i].prepid);
+        signal_container(&Ct[i], SIGKILL);
+    }
+
+    // Their cgroups can only go once they are reaped
+    while (Nct > 0) {
+        container *c = &Ct[Nct-1];
+
+        waitpid(c->pid, 0, 0);
+        forget(c);
+    }
+    unlink(sock);
+    return 0;
+}
+
+
+int
+nsd_request(const char *sock, const char *verb, int argc, char * const argv[])
+{
+    struct sockaddr_un sa;
+    char buf[3 * PATH_MAX + 128];
+    size_t n = 0;
+    int fd, i;
+
+    sockaddr_of(&sa, sock);
+
+    n += snprintf(buf, sizeof buf, "%s", verb) + 1;
+    for (i = 0; i < argc && n < sizeof buf; i++)
+        n += snprintf(buf+n, sizeof buf - n, "%s", argv[i]) + 1;
+    if (n > sizeof buf) die("request is too long");
+
+    if ((fd = socket(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0)) < 0) error(1, errno, "can't create socket");
+    if (connect(fd, (struct sockaddr *)&sa, sizeof sa) < 0) error(1, errno, "can't connect to %s", sock);
+    if (write(fd, buf, n) != (ssize_t)n) error(1, errno, "can't send request to %s", sock);
+
+    ssize_t m = read(fd, buf, sizeof buf - 1);
+    if (m <= 0) error(1, errno, "no reply from %s", sock);
+    buf[m] = 0;
+
+    if (0 != strncmp(buf, "ok ", 3)) die("%s", buf);
+
+    if (0 != strcmp(verb, "status")) {
+        printf("%s\n", buf+3);
+        close(fd);
+        return 0;
+    }
+
+    int k = atoi(buf+3);
+    for (i = 0; i < k; i++) {
+        if ((m = read(fd, buf, sizeof buf - 1)) <= 0) error(1, errno, "short status from %s", sock);
+        buf[m] = 0;
+        printf("%s\n", buf);
+    }
+    close(fd);
+    return 0;
+}
+
+/* EOF */
@@ -0,0 +1,146 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * oom.c - watch containers for OOM kills.
+ *
+ * A container that runs out of memory loses a random process to
+ * the OOM killer and limps on. Here it dies as a whole and every
+ * OOM is logged; see oom.h.
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+#include "stats.h"
+#include "oom.h"
+
+
+/*
+ * Return the value of 'key' in the "KEY VALUE" lines of 'buf'; 0
+ * if there is none.
+ */
+static uint64_t
+count(const char *buf, const char *key)
+{
+    size_t n = strlen(key);
+    const char *p = buf;
+
+    while (p) {
+        if (0 == strncmp(p, key, n) && p[n] == ' ') return strtoull(p+n+1, 0, 10);
+        if ((p = strchr(p, '\n'))) p++;
+    }
+    return 0;
+}
+
+
+int
+oom_open(oom *o, cgroup *cg)
+{
+    int r;
+
+    memset(o, 0, sizeof *o);
+    o->fd = o->ctl = -1;
+
+    if (cgroup_version() == CGROUP_V2) {
+        // Linux 4.19+; without it, the caller kills the container.
+        r = cgroup_write(cg, "memory", "memory.oom.group", "1");
+        if (r < 0 && r != -ENOENT) return r;
+
+        o->group  = r == 0;
+        o->events = POLLPRI;
+        o->fd     = cgroup_open(cg, "memory", "memory.events", O_RDONLY|O_CLOEXEC);
+        if (o->fd < 0) return o->fd;
+
+        // A read arms the next POLLPRI
+        oom_event(o);
+        return 0;
+    }
+
+    o->events = POLLIN;
+    o->ctl    = cgroup_open(cg, "memory", "memory.oom_control", O_RDONLY|O_CLOEXEC);
+    if (o->ctl < 0) return o->ctl;
+
+    if ((o->fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK)) < 0) {
+        r = -errno;
+        goto fail;
+    }
+
+    r = cgroup_write(cg, "memory", "cgroup.event_control", "%d %d", o->fd, o->ctl);
+    if (r < 0) goto fail;
+    return 0;
+
+fail:
+    oom_close(o);
+    return r;
+}
+
+
+void
+oom_close(oom *o)
+{
+    if (o->fd >= 0)  close(o->fd);
+    if (o->ctl >= 0) close(o->ctl);
+    o->fd = o->ctl = -1;
+}
+
+
+int
+oom_event(oom *o)
+{
+    char buf[512];
+    uint64_t ooms = o->oom, kills;
+    ssize_t  n;
+
+    n = pread(o->ctl >= 0 ? o->ctl : o->fd, buf, sizeof buf - 1, 0);
+    if (n < 0) return 0;
+    buf[n] = 0;
+
+    kills = count(buf, "oom_kill");
+
+    if (o->ctl < 0) {
+        ooms = count(buf, "oom");
+    } else {
+        uint64_t v;
+
+        // The eventfd counts OOMs since the last read
+        if (read(o->fd, &v, sizeof v) == sizeof v) ooms += v;
+    }
+
+    if (ooms == o->oom && kills == o->kill) return 0;
+
+    int k = (int)(ooms - o->oom + kills - o->kill);
+
+    o->oom  = ooms;
+    o->kill = kills;
+    stats_event(o->pid, "oom", "\"oom\":%llu,\"oom_kill\":%llu,\"group\":%d",
+                (unsigned long long)ooms, (unsigned long long)kills, o->group);
+    return k;
+}
+
+
+int
+oom_backoff(int n)
+{
+    int ms = OOM_BACKOFF_MS;
+
+    while (n-- > 0 && ms < OOM_BACKOFF_MAX) ms *= 2;
+    return ms < OOM_BACKOFF_MAX ? ms : OOM_BACKOFF_MAX;
+}
+
+/* EOF */
@@ -0,0 +1,89 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * oom.h - watch containers for OOM kills.
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+
+#ifndef ___OOM_H__Fy6tKb2Vr9QmXs3H___
+#define ___OOM_H__Fy6tKb2Vr9QmXs3H___ 1
+
+    /* Provide C linkage for symbols declared here .. */
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "cgroup.h"
+
+/*
+ * Left alone, the OOM killer takes one process of a container that
+ * hit its memory limit; what is left of the container runs on
+ * without it. Instead, the container dies as a whole:
+ *
+ *   v2: memory.oom.group is set; the kernel kills every process in
+ *       the cgroup. memory.events is polled (POLLPRI) for the
+ *       "oom" and "oom_kill" counts.
+ *   v1: an eventfd is registered for memory.oom_control through
+ *       cgroup.event_control; when it fires the caller kills the
+ *       container's init (and so its pid namespace).
+ *
+ * Events (see stats_event()):
+ *
+ *   "oom"     {"oom":N,"oom_kill":N,"group":0|1}
+ *   "restart" {"restart":N,"max":N,"backoff_ms":N,"down_ms":N,
+ *              "start_ms":N}
+ *
+ * "restart" is logged by the caller once a container that was OOM
+ * killed runs again (--restart): 'down_ms' is from its death until
+ * the new init runs, 'start_ms' that without the backoff.
+ */
+
+#define OOM_BACKOFF_MS      100     // before the first restart
+#define OOM_BACKOFF_MAX     30000   // doubles up to this
+
+struct oom
+{
+    pid_t    pid;       // set by the caller; for the log
+    int      fd;        // v2: memory.events; v1: eventfd
+    int      ctl;       // v1: memory.oom_control; -1 on v2
+    short    events;    // poll(2) events of 'fd'
+    int      group;     // the kernel kills the whole cgroup
+    uint64_t oom;       // OOMs so far
+    uint64_t kill;      // processes OOM killed so far
+};
+typedef struct oom oom;
+
+
+// Open the files of 'cg' and set memory.oom.group (v2); do this
+// before the kid is attached. Returns 0 or -errno.
+extern int  oom_open(oom *o, cgroup *cg);
+
+// Call when 'fd' polls for 'events' (or any time); returns the
+// number of new OOMs and OOM kills. If it is non-zero and 'group'
+// isn't set, it is up to the caller to kill the container.
+extern int  oom_event(oom *o);
+
+// Time to wait before restart 'n' (0 is the first).
+extern int  oom_backoff(int n);
+
+extern void oom_close(oom *o);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* ! ___OOM_H__Fy6tKb2Vr9QmXs3H___ */
+
+/* EOF */
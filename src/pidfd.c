@@ -0,0 +1,71 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * pidfd.c - process file descriptors.
+ *
+ * Thin wrappers over pidfd_open(2) and pidfd_send_signal(2) (Linux
+ * 5.3); libc wrappers aren't available everywhere.
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+
+#include "pidfd.h"
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open          434
+#endif
+#ifndef SYS_pidfd_send_signal
+#define SYS_pidfd_send_signal   424
+#endif
+
+
+int
+pidfd_of(pid_t pid)
+{
+    int fd = syscall(SYS_pidfd_open, pid, 0);
+
+    return fd < 0 ? -errno : fd;
+}
+
+
+int
+pidfd_kill(int pidfd, int sig)
+{
+    return syscall(SYS_pidfd_send_signal, pidfd, sig, 0, 0) < 0 ? -errno : 0;
+}
+
+
+int
+pidfd_wait(int pidfd, pid_t pid, int *st, int ms)
+{
+    struct pollfd p = { .fd = pidfd, .events = POLLIN };
+    int r;
+
+    while ((r = poll(&p, 1, ms)) < 0) {
+        if (errno != EINTR) return -errno;
+    }
+    if (r == 0) return -ETIMEDOUT;
+
+    while (waitpid(pid, st, 0) < 0) {
+        if (errno != EINTR) return -errno;
+    }
+    return 0;
+}
+
+/* EOF */
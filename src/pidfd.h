@@ -0,0 +1,50 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * pidfd.h - process file descriptors.
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+
+#ifndef ___PIDFD_H__Te3mWq9YcA6vNs1K___
+#define ___PIDFD_H__Te3mWq9YcA6vNs1K___ 1
+
+    /* Provide C linkage for symbols declared here .. */
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <sys/types.h>
+
+/*
+ * A pidfd becomes readable when its process exits; it can be
+ * polled along with other fds. Signals sent through it can't hit
+ * a recycled pid. All functions return -errno on failure.
+ */
+
+// Open a pidfd for our child 'pid'
+extern int pidfd_of(pid_t pid);
+
+// Send 'sig' to the process behind 'pidfd'
+extern int pidfd_kill(int pidfd, int sig);
+
+// Wait up to 'ms' milliseconds (-1: forever) for the child behind
+// 'pidfd' to exit; then reap 'pid' and return its wait status in
+// 'st'. Returns -ETIMEDOUT if it is still running.
+extern int pidfd_wait(int pidfd, pid_t pid, int *st, int ms);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* ! ___PIDFD_H__Te3mWq9YcA6vNs1K___ */
+
+/* EOF */
@@ -0,0 +1,300 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * place.c - topology aware cpu placement of containers.
+ *
+ * --cpuset=auto spreads containers over the machine: a container
+ * gets cpus that share a last level cache (and so a NUMA node)
+ * and are used by the fewest other containers; it avoids SMT
+ * siblings of cpus it already has. The load of a cpu is the number
+ * of container cgroups whose cpuset.cpus has it; so containers
+ * started by other 'ns' processes are counted too. Concurrent
+ * launches can race and pick the same cpus.
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sched.h>
+
+#include "cgroup.h"
+#include "place.h"
+
+#define SYSCPU      "/sys/devices/system/cpu"
+#define SYSNODE     "/sys/devices/system/node"
+
+struct cpu
+{
+    int node;   // NUMA node
+    int core;   // physical core; shared by SMT siblings
+    int llc;    // lowest cpu sharing the last level cache
+    int load;   // number of containers using this cpu
+};
+typedef struct cpu cpu;
+
+static cpu Cpu[CPU_SETSIZE];
+static int Max;     // highest online cpu + 1
+
+
+/*
+ * Parse a cpu list "0-3,8,10-11" into 'set'.
+ */
+static int
+parse_cpulist(const char *s, cpu_set_t *set)
+{
+    CPU_ZERO(set);
+
+    while (*s && *s != '\n') {
+        char *e;
+        long a = strtol(s, &e, 10), b = a;
+
+        if (e == s) return -EINVAL;
+        if (*e == '-') {
+            s = e + 1;
+            b = strtol(s, &e, 10);
+            if (e == s) return -EINVAL;
+        }
+        for (; a <= b && a < CPU_SETSIZE; a++) CPU_SET(a, set);
+
+        s = e;
+        if (*s == ',') s++;
+    }
+    return 0;
+}
+
+
+/*
+ * Format 'set' as a cpu list.
+ */
+static void
+format_cpulist(const cpu_set_t *set, char *buf, size_t n)
+{
+    size_t k = 0;
+    int i, j;
+
+    buf[0] = 0;
+    for (i = 0; i < CPU_SETSIZE && k < n; i = j) {
+        if (!CPU_ISSET(i, set)) { j = i + 1; continue; }
+
+        for (j = i + 1; j < CPU_SETSIZE && CPU_ISSET(j, set); j++);
+
+        if (j - 1 == i) k += snprintf(buf+k, n-k, "%s%d", k ? "," : "", i);
+        else            k += snprintf(buf+k, n-k, "%s%d-%d", k ? "," : "", i, j - 1);
+    }
+}
+
+
+static int
+readstr(const char *path, char *buf, size_t n)
+{
+    int fd = open(path, O_RDONLY|O_CLOEXEC);
+    ssize_t m;
+
+    if (fd < 0) return -errno;
+    m = read(fd, buf, n-1);
+    close(fd);
+    if (m < 0) return -errno;
+
+    buf[m] = 0;
+    return 0;
+}
+
+
+static int
+readint(const char *path, int def)
+{
+    char buf[32];
+
+    if (readstr(path, buf, sizeof buf) < 0) return def;
+    return atoi(buf);
+}
+
+
+/*
+ * Lowest cpu sharing the last level cache with 'c'; falls back to
+ * the package if the kernel doesn't describe the caches.
+ */
+static int
+llc_of(int c, int pkg)
+{
+    static const char *idx[] = { "index3", "index2", 0 };
+    char path[PATH_MAX];
+    char buf[1024];
+    const char **x;
+    cpu_set_t set;
+    int i;
+
+    for (x = idx; *x; x++) {
+        snprintf(path, sizeof path, SYSCPU "/cpu%d/cache/%s/shared_cpu_list", c, *x);
+        if (readstr(path, buf, sizeof buf) < 0 || parse_cpulist(buf, &set) < 0) continue;
+
+        for (i = 0; i < CPU_SETSIZE; i++) {
+            if (CPU_ISSET(i, &set)) return i;
+        }
+    }
+    return -1 - pkg;
+}
+
+
+static void
+read_nodes(void)
+{
+    char path[PATH_MAX+32];
+    char buf[1024];
+    struct dirent *de;
+    cpu_set_t set;
+    DIR *d;
+    int i;
+
+    if (!(d = opendir(SYSNODE))) return;
+
+    while ((de = readdir(d))) {
+        if (0 != strncmp(de->d_name, "node", 4)) continue;
+
+        snprintf(path, sizeof path, SYSNODE "/%s/cpulist", de->d_name);
+        if (readstr(path, buf, sizeof buf) < 0 || parse_cpulist(buf, &set) < 0) continue;
+
+        int node = atoi(de->d_name + 4);
+        for (i = 0; i < CPU_SETSIZE; i++) {
+            if (CPU_ISSET(i, &set)) Cpu[i].node = node;
+        }
+    }
+    closedir(d);
+}
+
+
+static void
+count_load(const char *val, void *arg)
+{
+    cpu_set_t set;
+    int i;
+
+    (void)arg;
+    if (parse_cpulist(val, &set) < 0) return;
+
+    for (i = 0; i < CPU_SETSIZE; i++) {
+        if (CPU_ISSET(i, &set)) Cpu[i].load++;
+    }
+}
+
+
+/*
+ * Sum of the load of 'c' and its SMT siblings.
+ */
+static int
+core_load(const cpu_set_t *online, int c)
+{
+    int i, load = 0;
+
+    for (i = 0; i < Max; i++) {
+        if (CPU_ISSET(i, online) && Cpu[i].core == Cpu[c].core) load += Cpu[i].load;
+    }
+    return load;
+}
+
+
+int
+place_cpus(int ncpu, char *cpus, size_t n, char *mems, size_t m)
+{
+    char path[PATH_MAX];
+    char buf[1024];
+    cpu_set_t online, pick;
+    int i, j, k, r;
+
+    if ((r = readstr(SYSCPU "/online", buf, sizeof buf)) < 0) return r;
+    if ((r = parse_cpulist(buf, &online)) < 0) return r;
+
+    for (Max = CPU_SETSIZE; Max > 0 && !CPU_ISSET(Max-1, &online); Max--);
+
+    for (i = 0; i < Max; i++) {
+        if (!CPU_ISSET(i, &online)) continue;
+
+        snprintf(path, sizeof path, SYSCPU "/cpu%d/topology/physical_package_id", i);
+        int pkg = readint(path, 0);
+
+        snprintf(path, sizeof path, SYSCPU "/cpu%d/topology/core_id", i);
+        Cpu[i].core = (pkg << 16) + readint(path, i);
+        Cpu[i].llc  = llc_of(i, pkg);
+        Cpu[i].node = 0;
+        Cpu[i].load = 0;
+    }
+
+    read_nodes();
+    cgroup_scan("cpuset", "cpuset.cpus", count_load, 0);
+
+    if (ncpu > CPU_COUNT(&online)) ncpu = CPU_COUNT(&online);
+
+    /*
+     * Pick the cache domain with the least load per cpu that has
+     * room for 'ncpu'; if none does, use the whole machine.
+     */
+    int best = -1, bload = 0, bsize = 0;
+
+    for (i = 0; i < Max; i++) {
+        if (!CPU_ISSET(i, &online) || Cpu[i].llc != i) continue;
+
+        int load = 0, size = 0;
+        for (j = 0; j < Max; j++) {
+            if (CPU_ISSET(j, &online) && Cpu[j].llc == i) { load += Cpu[j].load; size++; }
+        }
+        if (size < ncpu) continue;
+
+        if (best < 0 || (long)load * bsize < (long)bload * size) {
+            best  = i;
+            bload = load;
+            bsize = size;
+        }
+    }
+
+    /*
+     * Greedily take the least loaded cpus; a cpu whose core we
+     * already have counts as loaded by us.
+     */
+    CPU_ZERO(&pick);
+    for (k = 0; k < ncpu; k++) {
+        int c = -1, cl = 0;
+
+        for (i = 0; i < Max; i++) {
+            if (!CPU_ISSET(i, &online) || CPU_ISSET(i, &pick)) continue;
+            if (best >= 0 && Cpu[i].llc != best) continue;
+
+            int l = 2 * core_load(&online, i) + Cpu[i].load;
+            for (j = 0; j < Max; j++) {
+                if (CPU_ISSET(j, &pick) && Cpu[j].core == Cpu[i].core) l += 2 * CPU_SETSIZE;
+            }
+            if (c < 0 || l < cl) { c = i; cl = l; }
+        }
+        if (c < 0) break;
+        CPU_SET(c, &pick);
+    }
+
+    format_cpulist(&pick, cpus, n);
+
+    // A single node if all picked cpus are on it.
+    int node = -1;
+    for (i = 0; i < Max; i++) {
+        if (!CPU_ISSET(i, &pick)) continue;
+        if (node == -1) node = Cpu[i].node;
+        else if (node != Cpu[i].node) node = -2;
+    }
+
+    if (node >= 0) snprintf(mems, m, "%d", node);
+    else if (m > 0) mems[0] = 0;
+    return 0;
+}
+
+/* EOF */
@@ -0,0 +1,38 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * place.h - topology aware cpu placement of containers.
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+
+#ifndef ___PLACE_H__Mb7sQk2WcE9rLx4N___
+#define ___PLACE_H__Mb7sQk2WcE9rLx4N___ 1
+
+    /* Provide C linkage for symbols declared here .. */
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <stddef.h>
+
+// Pick 'ncpu' cpus for a new container; write them as a cpu list
+// to 'cpus' and the NUMA node to use to 'mems' ("" if the cpus
+// span nodes). Returns 0 or -errno.
+extern int place_cpus(int ncpu, char *cpus, size_t n, char *mems, size_t m);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* ! ___PLACE_H__Mb7sQk2WcE9rLx4N___ */
+
+/* EOF */
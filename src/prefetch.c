@@ -0,0 +1,387 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * prefetch.c - record and replay the files a container reads as it
+ *              starts.
+ *
+ * Cold starts are dominated by page faults on init and its
+ * libraries. Recording marks the container's root mount with
+ * fanotify and collects every file opened on it; at the end the
+ * parts of those files that made it into the page cache (mincore)
+ * are the ranges startup needed. Replay reads them ahead from a few
+ * threads -- so the I/O queue stays busy -- while the parent runs
+ * the pre-exec script.
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/fanotify.h>
+
+#include "trace.h"
+#include "prefetch.h"
+
+// Files recorded per container; the rest are ignored
+#define PREFETCH_FILES      1024
+
+#define PREFETCH_THREADS    4
+
+
+struct seen
+{
+    int   fd;
+    dev_t dev;
+    ino_t ino;
+};
+typedef struct seen seen;
+
+
+struct range
+{
+    uint64_t off, len;
+    char    *path;
+};
+typedef struct range range;
+
+// Shared by the replay threads; the last one out frees it.
+struct job
+{
+    char  *roots;
+    range *r;
+    int    n;
+    int    next;
+    int    refs;
+};
+typedef struct job job;
+
+
+void
+prefetch_manifest(char *buf, size_t n, const char *root)
+{
+    size_t len = strlen(root);
+
+    while (len > 1 && root[len-1] == '/') len--;
+    snprintf(buf, n, "%.*s.prefetch", (int)len, root);
+}
+
+
+int
+prefetch_watch(void)
+{
+    int fan = fanotify_init(FAN_CLASS_NOTIF|FAN_CLOEXEC|FAN_NONBLOCK, O_RDONLY|O_LARGEFILE|O_CLOEXEC);
+    if (fan < 0) return -errno;
+
+    if (fanotify_mark(fan, FAN_MARK_ADD|FAN_MARK_MOUNT, FAN_OPEN, AT_FDCWD, "/") < 0) {
+        int r = -errno;
+
+        close(fan);
+        return r;
+    }
+    return fan;
+}
+
+
+/*
+ * Keep the fd of each distinct file opened; it is read later.
+ */
+static void
+collect(int fan, seen *s, int *ns)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct fanotify_event_metadata))));
+    ssize_t n;
+
+    while ((n = read(fan, buf, sizeof buf)) > 0) {
+        struct fanotify_event_metadata *m = (void *)buf;
+
+        for (; FAN_EVENT_OK(m, n); m = FAN_EVENT_NEXT(m, n)) {
+            struct stat st;
+            int i;
+
+            if (m->fd < 0) continue;
+            if (fstat(m->fd, &st) < 0 || !S_ISREG(st.st_mode) || *ns == PREFETCH_FILES) {
+                close(m->fd);
+                continue;
+            }
+
+            for (i = 0; i < *ns; i++) {
+                if (s[i].dev == st.st_dev && s[i].ino == st.st_ino) break;
+            }
+            if (i < *ns) {
+                close(m->fd);
+                continue;
+            }
+
+            s[i].fd  = m->fd;
+            s[i].dev = st.st_dev;
+            s[i].ino = st.st_ino;
+            (*ns)++;
+        }
+    }
+}
+
+
+/*
+ * Write the resident ranges of file 'fd' to 'out'. A file that is
+ * not resident at all (evicted already) is listed whole.
+ */
+static void
+write_ranges(FILE *out, int fd)
+{
+    char path[PATH_MAX], proc[32];
+    struct stat st;
+    ssize_t k;
+
+    snprintf(proc, sizeof proc, "/proc/self/fd/%d", fd);
+    if ((k = readlink(proc, path, sizeof path - 1)) <= 0) return;
+    path[k] = 0;
+
+    // The kid's root isn't reachable from ours; so the path is the
+    // one the container sees.
+    if (path[0] != '/' || strchr(path, '\n')) return;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) return;
+
+    size_t pg  = sysconf(_SC_PAGESIZE);
+    size_t len = st.st_size;
+    size_t np  = (len + pg - 1) / pg;
+
+    void          *p = mmap(0, len, PROT_READ, MAP_SHARED, fd, 0);
+    unsigned char *v = malloc(np);
+
+    if (p == MAP_FAILED || !v || mincore(p, len, v) < 0) {
+        fprintf(out, "0 %zu %s\n", len, path);
+        goto out;
+    }
+
+    size_t i, start = 0, nr = 0;
+    for (i = 0; i <= np; i++) {
+        int in = i < np && (v[i] & 1);
+
+        if (in && (i == 0 || !(v[i-1] & 1))) start = i;
+        if (!in && i > 0 && (v[i-1] & 1)) {
+            uint64_t off = (uint64_t)start * pg;
+            uint64_t end = (uint64_t)i * pg;
+
+            if (end > len) end = len;
+            fprintf(out, "%" PRIu64 " %" PRIu64 " %s\n", off, end - off, path);
+            nr++;
+        }
+    }
+    if (nr == 0) fprintf(out, "0 %zu %s\n", len, path);
+
+out:
+    if (p != MAP_FAILED) munmap(p, len);
+    free(v);
+}
+
+
+int
+prefetch_record(int fan, int pidfd, const char *manifest, int ms)
+{
+    seen *s = calloc(PREFETCH_FILES, sizeof *s);
+    int   ns = 0, i, r = 0;
+
+    if (!s) {
+        close(fan);
+        return -ENOMEM;
+    }
+
+    uint64_t end = trace_now() + (uint64_t)ms * 1000000;
+    for (;;) {
+        struct pollfd pfd[2] = {
+            { .fd = fan,   .events = POLLIN },
+            { .fd = pidfd, .events = POLLIN },
+        };
+        uint64_t now = trace_now();
+
+        if (now >= end) break;
+        if (poll(pfd, 2, (int)((end - now) / 1000000) + 1) < 0 && errno != EINTR) {
+            r = -errno;
+            break;
+        }
+
+        collect(fan, s, &ns);
+        if (pfd[1].revents) break;
+    }
+    collect(fan, s, &ns);
+    close(fan);
+
+    char tmp[PATH_MAX];
+    FILE *out = 0;
+
+    snprintf(tmp, sizeof tmp, "%s.tmp", manifest);
+    if (r == 0 && !(out = fopen(tmp, "w"))) r = -errno;
+
+    for (i = 0; i < ns; i++) {
+        if (out) write_ranges(out, s[i].fd);
+        close(s[i].fd);
+    }
+    free(s);
+
+    if (!out) return r;
+
+    // Replace the old manifest atomically
+    if (fclose(out) != 0 || rename(tmp, manifest) < 0) {
+        r = -errno;
+        unlink(tmp);
+        return r;
+    }
+    return ns;
+}
+
+
+static void
+free_job(job *j)
+{
+    int i;
+
+    for (i = 0; i < j->n; i++) free(j->r[i].path);
+    free(j->r);
+    free(j->roots);
+    free(j);
+}
+
+
+static void
+put_job(job *j)
+{
+    if (__atomic_sub_fetch(&j->refs, 1, __ATOMIC_ACQ_REL) == 0) free_job(j);
+}
+
+
+static int
+open_under(const char *roots, const char *path)
+{
+    char buf[PATH_MAX];
+    const char *p, *q;
+
+    for (p = roots; p; p = q ? q+1 : 0) {
+        q = strchr(p, ':');
+
+        int n = q ? q - p : (int)strlen(p);
+        snprintf(buf, sizeof buf, "%.*s%s", n, p, path);
+
+        int fd = open(buf, O_RDONLY|O_CLOEXEC|O_NOATIME);
+        if (fd < 0 && errno == EPERM) fd = open(buf, O_RDONLY|O_CLOEXEC);
+        if (fd >= 0) return fd;
+    }
+    return -1;
+}
+
+
+static void *
+replay(void *arg)
+{
+    job *j = arg;
+    int i;
+
+    while ((i = __atomic_fetch_add(&j->next, 1, __ATOMIC_RELAXED)) < j->n) {
+        range *r = &j->r[i];
+        int   fd = open_under(j->roots, r->path);
+
+        if (fd < 0) continue;
+
+        // readahead(2) isn't supported everywhere (e.g., FUSE)
+        if (readahead(fd, r->off, r->len) < 0)
+            posix_fadvise(fd, r->off, r->len, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+
+    put_job(j);
+    return 0;
+}
+
+
+int
+prefetch_replay(const char *manifest, const char *roots)
+{
+    FILE *in = fopen(manifest, "r");
+    char  line[PATH_MAX+64];
+    int   max = 0, i, r;
+
+    if (!in) return -errno;
+
+    job *j = calloc(1, sizeof *j);
+    if (!j) goto nomem;
+
+    while (fgets(line, sizeof line, in)) {
+        uint64_t off, len;
+        int      pos = 0;
+        char    *nl  = strchr(line, '\n');
+
+        if (nl) *nl = 0;
+        if (sscanf(line, "%" SCNu64 " %" SCNu64 " %n", &off, &len, &pos) != 2 || line[pos] != '/') continue;
+
+        if (j->n == max) {
+            max   = max ? 2 * max : 64;
+            range *x = realloc(j->r, max * sizeof *x);
+
+            if (!x) goto nomem;
+            j->r = x;
+        }
+
+        range *e = &j->r[j->n];
+        e->off  = off;
+        e->len  = len;
+        if (!(e->path = strdup(line + pos))) goto nomem;
+        j->n++;
+    }
+    fclose(in);
+    in = 0;
+
+    if (j->n == 0 || !(j->roots = strdup(roots))) {
+        r = j->n == 0 ? 0 : -ENOMEM;
+        goto out;
+    }
+
+    /*
+     * The threads are detached: nobody waits for a prefetch. A
+     * thread that can't be started just leaves more work for the
+     * others.
+     */
+    int nt = j->n < PREFETCH_THREADS ? j->n : PREFETCH_THREADS;
+    pthread_attr_t a;
+
+    pthread_attr_init(&a);
+    pthread_attr_setdetachstate(&a, PTHREAD_CREATE_DETACHED);
+
+    j->refs = nt + 1;
+    for (i = 0; i < nt; i++) {
+        pthread_t t;
+
+        if (pthread_create(&t, &a, replay, j) != 0) put_job(j);
+    }
+    pthread_attr_destroy(&a);
+
+    r = j->n;
+    put_job(j);
+    return r;
+
+nomem:
+    r = -ENOMEM;
+out:
+    if (in) fclose(in);
+    if (j) free_job(j);
+    return r;
+}
+
+/* EOF */
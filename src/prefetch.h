@@ -0,0 +1,64 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * prefetch.h - record and replay the files a container reads as it
+ *              starts.
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+
+#ifndef ___PREFETCH_H__Hc4pZ8mVt2RwLs6N___
+#define ___PREFETCH_H__Hc4pZ8mVt2RwLs6N___ 1
+
+    /* Provide C linkage for symbols declared here .. */
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <stddef.h>
+
+/*
+ * The manifest is a text file with one range per line:
+ *
+ *      offset length /path/in/container
+ *
+ * All functions return -errno on failure.
+ */
+
+// How long to record a container's startup
+#define PREFETCH_RECORD_MS  10000
+
+// Name the manifest that goes with 'root' (a dir or image file)
+extern void prefetch_manifest(char *buf, size_t n, const char *root);
+
+// In the kid, after it pivots: watch every file opened on its root
+// mount. Needs CAP_SYS_ADMIN. Returns a fanotify fd for
+// prefetch_record().
+extern int  prefetch_watch(void);
+
+// Collect the files opened on 'fan' until the process behind
+// 'pidfd' exits or 'ms' milliseconds pass; then write the ranges
+// of them that are in the page cache to 'manifest'. Closes 'fan'.
+// Returns the number of files recorded.
+extern int  prefetch_record(int fan, int pidfd, const char *manifest, int ms);
+
+// Read ahead the ranges in 'manifest' in background threads; paths
+// are looked up under the ':' separated dirs in 'roots' (topmost
+// first). Returns the number of ranges queued.
+extern int  prefetch_replay(const char *manifest, const char *roots);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* ! ___PREFETCH_H__Hc4pZ8mVt2RwLs6N___ */
+
+/* EOF */
@@ -0,0 +1,183 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * spawn-bench.c - helper spawn latency against parent RSS.
+ *
+ * A supervisor starts a helper (e.g., the pre-exec script) for
+ * every launch. fork() copies the parent's page tables; so its cost
+ * grows with the parent's RSS. posix_spawn() (glibc:
+ * clone(CLONE_VM|CLONE_VFORK)) shares them until the exec. This
+ * grows the RSS of the process in steps and at each step starts
+ * /bin/true N times with either method.
+ *
+ * Usage: spawn-bench [N [MB ..]]    [100; 0 64 256 1024]
+ *
+ * Output is one JSON object per line on stdout:
+ *
+ *   {"method":"fork","rss_mb":256,"phase":"spawn","n":100,"p50_us":..,"p99_us":..,"max_us":..}
+ *
+ * 'spawn' is the time until the parent can go on; 'total' is until
+ * the helper is reaped.
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <spawn.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+
+#include "error.h"
+
+#define HELPER  "/bin/true"
+
+extern char **environ;
+
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static int
+cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+
+static void
+report(const char *method, size_t mb, const char *phase, uint64_t *v, int n)
+{
+    qsort(v, n, sizeof *v, cmp);
+    printf("{\"method\":\"%s\",\"rss_mb\":%zu,\"phase\":\"%s\",\"n\":%d,"
+           "\"p50_us\":%llu,\"p99_us\":%llu,\"max_us\":%llu}\n",
+           method, mb, phase, n,
+           (unsigned long long)v[(n - 1) / 2] / 1000,
+           (unsigned long long)v[(int)((n - 1) * 0.99)] / 1000,
+           (unsigned long long)v[n-1] / 1000);
+    fflush(stdout);
+}
+
+
+static pid_t
+by_fork(char * const argv[])
+{
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        execve(argv[0], argv, environ);
+        _exit(127);
+    }
+    return pid;
+}
+
+
+static pid_t
+by_spawn(char * const argv[])
+{
+    pid_t pid;
+    int   r = posix_spawn(&pid, argv[0], 0, 0, argv, environ);
+
+    if (r != 0) {
+        errno = r;
+        return -1;
+    }
+    return pid;
+}
+
+
+static void
+measure(const char *method, pid_t (*spawn)(char * const []), size_t mb, int n)
+{
+    char * const argv[] = { HELPER, 0 };
+    uint64_t *sp = calloc(n, sizeof *sp);
+    uint64_t *tt = calloc(n, sizeof *tt);
+    int i;
+
+    if (!sp || !tt) die("out of memory");
+
+    for (i = 0; i < n; i++) {
+        uint64_t t0 = now_ns();
+        pid_t   pid = (*spawn)(argv);
+
+        if (pid < 0) error(1, errno, "can't start %s", HELPER);
+
+        uint64_t t1 = now_ns();
+        int st;
+
+        if (waitpid(pid, &st, 0) < 0) error(1, errno, "can't wait for %s", HELPER);
+        sp[i] = t1 - t0;
+        tt[i] = now_ns() - t0;
+    }
+
+    report(method, mb, "spawn", sp, n);
+    report(method, mb, "total", tt, n);
+    free(sp);
+    free(tt);
+}
+
+
+int
+main(int argc, char * const argv[])
+{
+    static const char *dflt[] = { "0", "64", "256", "1024" };
+    const char * const *sizes = dflt;
+    int nsizes = 4;
+    int n      = 100;
+    int i;
+
+    program_name = argv[0];
+    if (argc > 1 && (n = atoi(argv[1])) <= 0) die("Usage: %s [N [MB ..]]", argv[0]);
+    if (argc > 2) {
+        sizes  = (const char * const *)&argv[2];
+        nsizes = argc - 2;
+    }
+
+    // RSS only grows; so the sizes are taken in increasing order.
+    size_t have = 0;
+    for (i = 0; i < nsizes; i++) {
+        size_t mb = strtoul(sizes[i], 0, 10);
+
+        if (mb > have) {
+            size_t len = (mb - have) << 20;
+            char  *p   = mmap(0, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+
+            if (p == MAP_FAILED) error(1, errno, "can't map %zu MB", mb - have);
+
+            // Small pages: a heap grown by malloc() rarely gets huge
+            // pages and each page is a page table entry to copy.
+            madvise(p, len, MADV_NOHUGEPAGE);
+            memset(p, 1, len);
+            have = mb;
+        }
+
+        measure("fork",  by_fork,  have, n);
+        measure("spawn", by_spawn, have, n);
+    }
+    return 0;
+}
+
+/* EOF */
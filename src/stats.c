@@ -0,0 +1,350 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * stats.c - live resource telemetry of containers.
+ *
+ * Every file is opened once per container; a sample is a pread(2)
+ * of each at offset 0 -- no path lookups or opens per sample. The
+ * contents are turned into JSON generically: "key value" lines
+ * become members, "key k=v .." lines (io.stat, PSI) become nested
+ * objects and so do "key sub value" lines (v1 blkio).
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "stats.h"
+
+// Longest sample line; a longer one is dropped
+#define STATS_LINE      32768
+
+struct source
+{
+    int         version;
+    const char *ctl;
+    const char *file;
+};
+
+static const struct source Sources[] =
+{
+      { CGROUP_V2, "memory",  "memory.current" }
+    , { CGROUP_V2, "memory",  "memory.stat" }
+    , { CGROUP_V2, "cpu",     "cpu.stat" }
+    , { CGROUP_V2, "io",      "io.stat" }
+    , { CGROUP_V2, "memory",  "memory.pressure" }
+    , { CGROUP_V2, "cpu",     "cpu.pressure" }
+    , { CGROUP_V2, "io",      "io.pressure" }
+
+    , { CGROUP_V1, "memory",  "memory.usage_in_bytes" }
+    , { CGROUP_V1, "memory",  "memory.stat" }
+    , { CGROUP_V1, "cpuacct", "cpuacct.usage" }
+    , { CGROUP_V1, "cpu",     "cpu.stat" }
+    , { CGROUP_V1, "blkio",   "blkio.throttle.io_service_bytes" }
+    , { 0, 0, 0 }
+};
+
+struct line
+{
+    char   b[STATS_LINE];
+    size_t n;
+};
+typedef struct line line;
+
+static int Out = -1;
+
+
+static int
+connect_to(const char *path)
+{
+    struct sockaddr_un sa;
+    int fd;
+
+    memset(&sa, 0, sizeof sa);
+    sa.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof sa.sun_path) return -ENAMETOOLONG;
+    strcpy(sa.sun_path, path);
+
+    // A stream of lines, or one datagram per line
+    if ((fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0)) < 0) return -errno;
+    if (connect(fd, (struct sockaddr *)&sa, sizeof sa) == 0) goto done;
+
+    close(fd);
+    if (errno != EPROTOTYPE) return -errno;
+
+    if ((fd = socket(AF_UNIX, SOCK_DGRAM|SOCK_CLOEXEC, 0)) < 0) return -errno;
+    if (connect(fd, (struct sockaddr *)&sa, sizeof sa) < 0) {
+        int r = -errno;
+
+        close(fd);
+        return r;
+    }
+
+done:
+    Out = fd;
+    return 0;
+}
+
+
+int
+stats_output(const char *dest)
+{
+    struct stat st;
+
+    if (0 == strcmp(dest, "-")) {
+        Out = 1;
+        return 0;
+    }
+
+    if (stat(dest, &st) == 0 && S_ISSOCK(st.st_mode)) return connect_to(dest);
+
+    Out = open(dest, O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0644);
+    return Out < 0 ? -errno : 0;
+}
+
+
+int
+stats_open(stats *s, cgroup *cg)
+{
+    const struct source *src;
+    int v = cgroup_version();
+
+    memset(s, 0, sizeof *s);
+    for (src = Sources; src->file; src++) {
+        if (src->version != v || s->n == STATS_FILES) continue;
+
+        int fd = cgroup_open(cg, src->ctl, src->file, O_RDONLY);
+        if (fd < 0) continue;
+
+        s->fd[s->n]   = fd;
+        s->name[s->n] = src->file;
+        s->n++;
+    }
+    return s->n;
+}
+
+
+void
+stats_close(stats *s)
+{
+    int i;
+
+    for (i = 0; i < s->n; i++) close(s->fd[i]);
+    s->n = 0;
+}
+
+
+static void
+vput(line *o, const char *fmt, va_list ap)
+{
+    if (o->n >= sizeof o->b) return;
+
+    int m = vsnprintf(o->b + o->n, sizeof o->b - o->n, fmt, ap);
+    if (m > 0) o->n += m;
+}
+
+
+static void
+put(line *o, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vput(o, fmt, ap);
+    va_end(ap);
+}
+
+
+static unsigned long long
+wallclock_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+static ssize_t
+out(int fd, const char *b, size_t n)
+{
+    ssize_t m = send(fd, b, n, MSG_DONTWAIT|MSG_NOSIGNAL);
+
+    if (m < 0 && errno == ENOTSOCK) m = write(fd, b, n);
+    return m < 0 ? -errno : m;
+}
+
+
+/*
+ * Never block the supervisor on a slow reader. A stream can take
+ * part of a line; the rest of it goes out before anything else and
+ * lines that come in meanwhile are dropped -- so no line is ever
+ * cut short.
+ */
+static int
+emit(int fd, line *o)
+{
+    static line rest;
+    ssize_t m;
+
+    if (o->n >= sizeof o->b) return -E2BIG;
+
+    if (fd == Out && rest.n > 0) {
+        if ((m = out(fd, rest.b, rest.n)) < 0) return (int)m;
+
+        rest.n -= m;
+        memmove(rest.b, rest.b + m, rest.n);
+        if (rest.n > 0) return -EAGAIN;
+    }
+
+    if ((m = out(fd, o->b, o->n)) < 0) return (int)m;
+
+    if ((size_t)m < o->n && fd == Out) {
+        rest.n = o->n - m;
+        memcpy(rest.b, o->b + m, rest.n);
+    }
+    return 0;
+}
+
+
+/*
+ * Numbers go out as is; anything else as a string.
+ */
+static void
+value(line *o, const char *v)
+{
+    char *end = 0;
+
+    strtod(v, &end);
+    if (*v && end && !*end) put(o, "%s", v);
+    else                    put(o, "\"%s\"", v);
+}
+
+
+/*
+ * Append the contents 'text' of file 'name' as a JSON member.
+ */
+static void
+member(line *o, const char *name, char *text)
+{
+    char *ls, *ts, *p;
+    const char *group = 0;  // open "key sub value" object
+    int first = 1;
+
+    put(o, ",\"%s\":", name);
+
+    if (!strpbrk(text, " \n")) {
+        value(o, text);
+        return;
+    }
+
+    put(o, "{");
+    for (p = strtok_r(text, "\n", &ls); p; p = strtok_r(0, "\n", &ls)) {
+        char *k = strtok_r(p, " ", &ts);
+        char *a = strtok_r(0, " ", &ts);
+        char *b = strtok_r(0, " ", &ts);
+
+        if (!k || !a) continue;
+
+        // Continue the object of the previous line
+        if (group && b && 0 == strcmp(group, k)) {
+            put(o, ",\"%s\":", a);
+            value(o, b);
+            continue;
+        }
+
+        if (group) put(o, "}");
+        group = 0;
+
+        put(o, "%s\"%s\":", first ? "" : ",", k);
+        first = 0;
+
+        if (strchr(a, '=')) {
+            const char *sep = "";
+
+            put(o, "{");
+            for (; a; a = b, b = strtok_r(0, " ", &ts)) {
+                char *eq = strchr(a, '=');
+                if (!eq) continue;
+
+                *eq = 0;
+                put(o, "%s\"%s\":", sep, a);
+                value(o, eq+1);
+                sep = ",";
+            }
+            put(o, "}");
+        } else if (b) {
+            put(o, "{\"%s\":", a);
+            value(o, b);
+            group = k;
+        } else {
+            value(o, a);
+        }
+    }
+    if (group) put(o, "}");
+    put(o, "}");
+}
+
+
+int
+stats_sample(stats *s)
+{
+    static line o;
+    char buf[8192];
+    int i;
+
+    if (Out < 0 || s->n == 0) return 0;
+
+    o.n = 0;
+    put(&o, "{\"pid\":%d,\"t_ms\":%llu", s->pid, wallclock_ms());
+
+    for (i = 0; i < s->n; i++) {
+        ssize_t m = pread(s->fd[i], buf, sizeof buf - 1, 0);
+        if (m <= 0) continue;
+
+        while (m > 0 && buf[m-1] == '\n') m--;
+        buf[m] = 0;
+        member(&o, s->name[i], buf);
+    }
+    put(&o, "}\n");
+    return emit(Out, &o);
+}
+
+
+int
+stats_event(pid_t pid, const char *event, const char *fmt, ...)
+{
+    static line o;
+    va_list ap;
+
+    o.n = 0;
+    put(&o, "{\"pid\":%d,\"t_ms\":%llu,\"event\":\"%s\",", pid, wallclock_ms(), event);
+
+    va_start(ap, fmt);
+    vput(&o, fmt, ap);
+    va_end(ap);
+
+    put(&o, "}\n");
+    return emit(Out >= 0 ? Out : 2, &o);
+}
+
+/* EOF */
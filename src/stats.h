@@ -0,0 +1,89 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * stats.h - live resource telemetry of containers.
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+
+#ifndef ___STATS_H__Lx2cW8nQe5RfTj7D___
+#define ___STATS_H__Lx2cW8nQe5RfTj7D___ 1
+
+    /* Provide C linkage for symbols declared here .. */
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "cgroup.h"
+
+/*
+ * The cgroup files of a container are opened once and re-read with
+ * pread(2) for every sample. A sample is one line of JSON with the
+ * parsed contents of each file under its name:
+ *
+ *   {"pid":N,"t_ms":WALLCLOCK,"memory.current":N,
+ *    "memory.stat":{"anon":N,..},"cpu.stat":{"usage_usec":N,..},
+ *    "io.stat":{"8:0":{"rbytes":N,..}},
+ *    "memory.pressure":{"some":{"avg10":F,..},"full":{..}},..}
+ *
+ * v1 has no per-cgroup pressure files; the memory, cpu and I/O
+ * numbers come from its equivalents (memory.usage_in_bytes,
+ * cpuacct.usage, blkio.throttle.io_service_bytes, ..).
+ */
+
+#define STATS_FILES     8
+
+struct stats
+{
+    pid_t       pid;                // set by the caller
+    int         n;
+    int         fd[STATS_FILES];
+    const char *name[STATS_FILES];
+};
+typedef struct stats stats;
+
+
+// Send samples to 'dest': a file (appended to), a unix socket or
+// "-" for stdout. Returns 0 or -errno.
+extern int  stats_output(const char *dest);
+
+// Open the telemetry files of 'cg'; do this before the kid is
+// attached to it. Missing files are skipped. Returns the number of
+// files opened.
+extern int  stats_open(stats *s, cgroup *cg);
+
+// Read the files of 's' and send one sample. A sample that can't be
+// sent right away (e.g., to a full socket) is dropped. Returns 0 or
+// -errno.
+extern int  stats_sample(stats *s);
+
+extern void stats_close(stats *s);
+
+// Log an event of container 'pid' as one JSON line
+//
+//   {"pid":N,"t_ms":WALLCLOCK,"event":"EVENT",MEMBERS}
+//
+// where 'fmt' and the rest format MEMBERS. Events go where the
+// samples go; without --stats-interval, to stderr. Returns 0 or
+// -errno.
+extern int  stats_event(pid_t pid, const char *event, const char *fmt, ...)
+                __attribute__((format(printf, 3, 4)));
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* ! ___STATS_H__Lx2cW8nQe5RfTj7D___ */
+
+/* EOF */
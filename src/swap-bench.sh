@@ -0,0 +1,148 @@
+#! /bin/bash
+
+#
+# Container density and latency with and without swap for 'ns'.
+#
+# For each configuration below, starts N containers at once, each
+# limited to MEM (--memory) and each running dd(1) over a working
+# set of WSET bytes PASSES times; so pages that went to swap are
+# touched again. A container that is OOM killed makes its 'ns'
+# fail. Reported are the number of containers that survived (the
+# density at this limit), the wall time of the survivors and the
+# peak swap use of the host.
+#
+# Usage: swap-bench.sh path/to/ns [rootdir]
+#
+# Environment:
+#   N       number of containers per configuration [8]
+#   MEM     memory limit of each container [32M]
+#   WSET    working set of each container; dd(1) block size [48M]
+#   PASSES  passes over the working set [4]
+#   CONFIGS space separated list of configurations to run
+#           [noswap swap zswap zram]
+#           'noswap' is --swap=0; what --memory alone does.
+#           'swap' goes straight to the swap device (--zswap=0).
+#           'zswap' uses zswap as the host has it set up.
+#           'zram' is zswap without writeback
+#           (--zswap-writeback=off): compressed pages stay in RAM.
+#           The last two need cgroup v2 and zswap enabled
+#           (/sys/module/zswap/parameters/enabled); configurations
+#           that 'ns' refuses are skipped.
+#
+# Output is one JSON object per line on stdout:
+#
+#   {"config":"swap","n":8,"survived":8,"p50_ms":..,"p99_ms":..,"max_ms":..,"swap_peak_kb":..}
+#
+# Diagnostics go to stderr. Needs root privileges and swap.
+#
+
+Z=$0
+
+die() {
+    echo "$Z: $@" 1>&2
+    exit 1
+}
+
+warn() {
+    echo "$Z: $@" 1>&2
+}
+
+[ -n "$1" ] || die "Usage: $Z path/to/ns [rootdir]"
+
+exe=$(realpath $1)
+root=${2:-/tmp/zzbench}
+N=${N:-8}
+MEM=${MEM:-32M}
+WSET=${WSET:-48M}
+PASSES=${PASSES:-4}
+CONFIGS=${CONFIGS:-"noswap swap zswap zram"}
+
+[ -x "$exe" ]    || die "can't find executable $exe"
+[ $(id -u) -eq 0 ] || die "Need root privileges to run"
+grep -q '^/' /proc/swaps || warn "no swap is enabled; every config is 'noswap'"
+
+if [ ! -d $root ]; then
+    (cd $(dirname $0) && ./mk-test-root.sh $root) 1>&2 || die "can't make rootfs $root"
+fi
+
+tmp=$(mktemp -d /tmp/nsswap.XXXXXX) || die "can't make tempdir"
+work=/swap-work.sh
+trap "rm -rf $tmp $root$work" EXIT
+
+cat > $root$work <<EOF
+#! /bin/sh
+exec dd if=/dev/zero of=/dev/null bs=$WSET count=$PASSES 2>/dev/null
+EOF
+chmod 755 $root$work
+
+# Print the ns options for a named configuration
+opts() {
+    case $1 in
+        noswap) echo "-W 0" ;;
+        swap)   echo "-W unlimited -Z 0" ;;
+        zswap)  echo "-W unlimited" ;;
+        zram)   echo "-W unlimited -k off" ;;
+        *)      die "unknown config $1" ;;
+    esac
+}
+
+# now in microseconds
+now_us() {
+    local t=$(date +%s%N)
+    echo $(( t / 1000 ))
+}
+
+# swap in use in kB
+swap_kb() {
+    awk '/^SwapTotal:/ { t = $2 } /^SwapFree:/ { f = $2 } END { print t - f }' /proc/meminfo
+}
+
+# run CONFIG I: one container; its wall time goes to $tmp/CONFIG.I
+run() {
+    local t0=$(now_us)
+
+    $exe -m $MEM $(opts $1) - $root $work 1>/dev/null 2>&1 || return
+    echo $(( ($(now_us) - t0) / 1000 )) > $tmp/$1.$2
+}
+
+# measure CONFIG
+measure() {
+    local cfg=$1
+    local base=$(swap_kb)
+    local peak=0
+    local pids=
+    local i=0
+
+    rm -f $tmp/$cfg.*
+    while [ $i -lt $N ]; do
+        run $cfg $i &
+        pids="$pids $!"
+        i=$(( i + 1 ))
+    done
+
+    while kill -0 $pids 2>/dev/null; do
+        local s=$(( $(swap_kb) - base ))
+        [ $s -gt $peak ] && peak=$s
+        sleep 0.1
+    done
+    wait
+
+    cat $tmp/$cfg.* 2>/dev/null | sort -n | awk -v cfg=$cfg -v n=$N -v peak=$peak '
+        { v[NR] = $1 }
+        END {
+            p50 = NR ? v[int((NR - 1) * 0.50) + 1] : 0
+            p99 = NR ? v[int((NR - 1) * 0.99) + 1] : 0
+            printf "{\"config\":\"%s\",\"n\":%d,\"survived\":%d,\"p50_ms\":%d,\"p99_ms\":%d,\"max_ms\":%d,\"swap_peak_kb\":%d}\n",
+                   cfg, n, NR, p50, p99, v[NR], peak
+        }'
+}
+
+for c in $CONFIGS; do
+    if ! $exe -m $MEM $(opts $c) - $root /bin/true 1>/dev/null 2>$tmp/err; then
+        warn "skipping config '$c': $(tail -1 $tmp/err)"
+        continue
+    fi
+
+    warn "running $N containers of config '$c' .."
+    measure $c
+done
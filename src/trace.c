@@ -0,0 +1,184 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * trace.c - low overhead startup phase tracing.
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include "error.h"
+#include "trace.h"
+
+#define TRACE_MAX       64
+#define TRACE_NAMELEN   15
+
+struct trace_ev
+{
+    uint64_t ns;
+    char     who;                   // 'p' (parent) or 'c' (child)
+    char     name[TRACE_NAMELEN];   // not necessarily nul terminated
+};
+typedef struct trace_ev trace_ev;
+
+// Events of a launch in flight; see trace_save()
+struct trace
+{
+    int      n;
+    trace_ev ev[TRACE_MAX];
+};
+
+static trace_ev Ev[TRACE_MAX];
+static int      Nev = 0;
+static char     Who = 'p';
+
+
+uint64_t
+trace_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+
+void
+trace_mark(const char *name)
+{
+    if (Nev == TRACE_MAX) return;
+
+    trace_ev *e = &Ev[Nev++];
+
+    e->ns  = trace_now();
+    e->who = Who;
+    strncpy(e->name, name, TRACE_NAMELEN);
+}
+
+
+void
+trace_child(void)
+{
+    Nev = 0;
+    Who = 'c';
+}
+
+
+void
+trace_reset(void)
+{
+    Nev = 0;
+}
+
+
+struct trace *
+trace_save(void)
+{
+    struct trace *t = malloc(sizeof *t);
+
+    if (t) {
+        t->n = Nev;
+        memcpy(t->ev, Ev, Nev * sizeof Ev[0]);
+    }
+    Nev = 0;
+    return t;
+}
+
+
+void
+trace_load(struct trace *t)
+{
+    Nev = 0;
+    if (!t) return;
+
+    Nev = t->n;
+    memcpy(Ev, t->ev, Nev * sizeof Ev[0]);
+    free(t);
+}
+
+
+void
+trace_send(int fd)
+{
+    size_t n = Nev * sizeof Ev[0];
+
+    // The child is about to exec; a failure here only costs us
+    // the child's timestamps.
+    if (n != write(fd, Ev, n)) error(0, errno, "child: can't send trace");
+}
+
+
+int
+trace_recv(int fd)
+{
+    size_t  n = (TRACE_MAX - Nev) * sizeof Ev[0];
+    ssize_t m = read(fd, &Ev[Nev], n);
+
+    if (m < 0)  return -errno;
+    if (m == 0) return -EPIPE;  // child died before exec
+
+    Nev += m / sizeof Ev[0];
+    return 0;
+}
+
+
+void
+trace_write(const char *file, int pid)
+{
+    FILE *fp = stdout;
+    int i, j;
+
+    if (0 != strcmp(file, "-")) {
+        fp = fopen(file, "w");
+        if (!fp) {
+            error(0, errno, "can't create trace file %s", file);
+            return;
+        }
+    }
+
+    // Parent and child events are interleaved; sort by time.
+    for (i = 1; i < Nev; i++) {
+        trace_ev e = Ev[i];
+
+        for (j = i; j > 0 && Ev[j-1].ns > e.ns; j--) Ev[j] = Ev[j-1];
+        Ev[j] = e;
+    }
+
+    // Skip stale child events
+    for (i = 0; i < Nev && Ev[i].who != 'p'; i++);
+    if (i == Nev) i = 0;
+
+    uint64_t t0   = Nev > 0 ? Ev[i].ns : 0;
+    uint64_t prev = t0;
+
+    fprintf(fp, "{\"pid\":%d,\"events\":[\n", pid);
+    for (; i < Nev; i++) {
+        trace_ev *e = &Ev[i];
+
+        fprintf(fp, "  {\"who\":\"%s\",\"phase\":\"%.*s\",\"t_ns\":%" PRIu64 ",\"dt_ns\":%" PRIu64 "}%s\n",
+                e->who == 'c' ? "child" : "parent", TRACE_NAMELEN, e->name,
+                e->ns - t0, e->ns - prev, (i+1) < Nev ? "," : "");
+        prev = e->ns;
+    }
+    fprintf(fp, "]}\n");
+
+    if (fp == stdout) fflush(fp);
+    else              fclose(fp);
+}
+
+/* EOF */
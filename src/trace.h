@@ -0,0 +1,76 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * trace.h - low overhead startup phase tracing.
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+
+#ifndef ___TRACE_H__Qm3vX8TzRk2LbW9e___
+#define ___TRACE_H__Qm3vX8TzRk2LbW9e___ 1
+
+    /* Provide C linkage for symbols declared here .. */
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <stdint.h>
+
+/*
+ * Phase tracing records a CLOCK_MONOTONIC timestamp at the end of
+ * each startup phase into a fixed in-memory buffer. Nothing is
+ * formatted or written until trace_write() is called.
+ *
+ * The child records into its own (cloned) copy of the buffer and
+ * ships its events to the parent over the container socketpair
+ * with trace_send(); the parent merges them with trace_recv().
+ */
+
+// Record the end of phase 'name'. Names longer than 15 chars are
+// truncated.
+extern void trace_mark(const char *name);
+
+// Called once in the child after clone(): discard the events
+// inherited from the parent and tag new events as the child's.
+extern void trace_child(void);
+
+// Discard all events; used when one process traces many launches.
+extern void trace_reset(void);
+
+// Move the events recorded so far out of the buffer (which is left
+// empty); for a launch that goes on while others are traced. Returns
+// 0 if out of memory. trace_load() puts them back and frees them.
+struct trace;
+extern struct trace *trace_save(void);
+extern void trace_load(struct trace *t);
+
+// Send the child's events to the parent on 'fd'.
+extern void trace_send(int fd);
+
+// Receive the child's events from 'fd' and merge them.
+// Returns 0 on success, -errno on failure.
+extern int  trace_recv(int fd);
+
+// Write all events as JSON to 'file' ("-" is stdout). Child events
+// older than the parent's first event (e.g., from a kid that was
+// parked before trace_reset()) are not written.
+extern void trace_write(const char *file, int pid);
+
+// Current CLOCK_MONOTONIC time in nanoseconds
+extern uint64_t trace_now(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* ! ___TRACE_H__Qm3vX8TzRk2LbW9e___ */
+
+/* EOF */
@@ -0,0 +1,130 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * zygote.c - pre-forked container pool.
+ *
+ * The pool keeps a number of kids cloned into their new namespaces
+ * (and with their uid/gid maps written) parked at the socketpair
+ * barrier in child_func(). Launching a container then only has to
+ * run the per-container steps and release one parked kid with its
+ * rootfs and init; clone and namespace creation are off the
+ * critical path. See nsd.c for the daemon that uses it.
+ *
+ * Copyright (c) 2017 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/types.h>
+
+#include "error.h"
+#include "pidfd.h"
+#include "ns.h"
+
+#define ZYGOTE_MAX  256
+
+struct zygote
+{
+    pid_t pid;
+    int   fd;       // parent's end of the kid's socketpair
+    int   pidfd;
+};
+typedef struct zygote zygote;
+
+static zygote Park[ZYGOTE_MAX];
+static int    Nparked = 0;
+
+static int    Flags;
+static int    Uid, Gid;
+static void (*Watch)(pid_t pid, int pidfd);
+
+
+void
+zygote_init(int flags, int uid, int gid, void (*watch)(pid_t pid, int pidfd))
+{
+    if (Zygotes < 0 || Zygotes > ZYGOTE_MAX) die("--zygotes must be between 0 and %d", ZYGOTE_MAX);
+
+    Flags = flags;
+    Uid   = uid;
+    Gid   = gid;
+    Watch = watch;
+}
+
+
+/*
+ * Clone one more kid and park it.
+ */
+static void
+park(void)
+{
+    zygote *z = &Park[Nparked];
+
+    z->pid = spawn_child(Flags, 0, &z->fd, &z->pidfd);
+    if (Flags & CLONE_NEWUSER) map_ids(z->pid, Uid, Gid);
+    if (Watch) Watch(z->pid, z->pidfd);
+
+    Nparked++;
+    progress("zygote: parked kid %d\n", z->pid);
+}
+
+
+void
+zygote_fill(void)
+{
+    while (Nparked < Zygotes) park();
+}
+
+
+pid_t
+zygote_take(int *fdp, int *pidfdp)
+{
+    if (Nparked == 0) {
+        if (Zygotes > 0) progress("zygote: pool is empty ..\n");
+        park();
+    }
+
+    zygote *z = &Park[--Nparked];
+
+    *fdp    = z->fd;
+    *pidfdp = z->pidfd;
+    return z->pid;
+}
+
+
+int
+zygote_forget(pid_t pid)
+{
+    int i;
+
+    for (i = 0; i < Nparked; i++) {
+        if (Park[i].pid != pid) continue;
+
+        close(Park[i].fd);
+        close(Park[i].pidfd);
+        Park[i] = Park[--Nparked];
+        return 1;
+    }
+    return 0;
+}
+
+
+void
+zygote_kill(void)
+{
+    int i;
+
+    for (i = 0; i < Nparked; i++) pidfd_kill(Park[i].pidfd, SIGKILL);
+}
+
+/* EOF */